@@ -0,0 +1,220 @@
+// Microbenchmarks of the local building blocks: the sparse-dense kernel, merges and splits of matrices,
+// the parser and generation of dense and sparse matrices.
+//
+// Usage: matrixmul_bench [filter] [min_seconds]
+// Every benchmark matching the filter (a substring of its name) is repeated for at least min_seconds (0.2 by
+// default). Results are printed as JSON lines on stdout:
+//   {"name": ..., "iterations": ..., "seconds": <per iteration>, "gflops": ..., "gbs": ...}
+// where GB/s counts the bytes read and written by a single iteration (as given by the benchmark).
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "matrix.h"
+#include "parser.h"
+#include "sparsematgen.h"
+
+namespace {
+
+std::string filter;
+double min_seconds = 0.2;
+
+// Runs 'f' (after a warm-up) until it takes at least min_seconds and prints the rates per iteration.
+// 'setup' (if given) prepares the inputs before every run of 'f' and isn't timed.
+void run(const std::string &name, double flops, double bytes, const std::function<void()> &f,
+         const std::function<void()> &setup = nullptr) {
+    if (name.find(filter) == std::string::npos) {
+        return;
+    }
+    if (setup) {
+        setup();
+    }
+    f();
+    long iterations = 0;
+    double elapsed = 0;
+    while (elapsed < min_seconds) {
+        if (setup) {
+            setup();
+        }
+        auto start = std::chrono::steady_clock::now();
+        f();
+        elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        iterations++;
+    }
+    double seconds = elapsed / iterations;
+    std::cout << "{\"name\": \"" << name << "\", \"iterations\": " << iterations << ", \"seconds\": " << seconds
+              << ", \"gflops\": " << flops / seconds * 1e-9 << ", \"gbs\": " << bytes / seconds * 1e-9 << "}"
+              << std::endl;
+}
+
+// Square matrix with (about) a given number of values in every row, in random columns.
+std::unique_ptr<matrix::Sparse> random_sparse(int n, int values_per_row, unsigned seed) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> column(0, n - 1);
+    std::uniform_real_distribution<double> value(-1, 1);
+    matrix::Buffer<double> values;
+    matrix::Buffer<matrix::index_t> rows_number_of_values = {0};
+    matrix::Buffer<int> values_column;
+    for (int r = 0; r < n; r++) {
+        std::vector<int> columns;
+        for (int i = 0; i < values_per_row; i++) {
+            columns.push_back(column(random));
+        }
+        std::sort(columns.begin(), columns.end());
+        columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+        for (int c : columns) {
+            values.push_back(value(random));
+            values_column.push_back(c);
+        }
+        rows_number_of_values.push_back(static_cast<matrix::index_t>(values.size()));
+    }
+    return std::make_unique<matrix::Sparse>(n, std::move(values), std::move(rows_number_of_values),
+                                            std::move(values_column));
+}
+
+std::string parameters(const std::string &name, std::initializer_list<std::pair<const char *, long>> items) {
+    std::string result = name;
+    for (const auto &item : items) {
+        result += "/" + std::string(item.first) + ":" + std::to_string(item.second);
+    }
+    return result;
+}
+
+void bench_multiply() {
+    const int n = 1 << 14;
+    for (int values_per_row : {4, 16, 64}) {
+        auto a = random_sparse(n, values_per_row, 1);
+        for (int columns : {1, 8, 64}) {
+            auto range = std::make_pair(0, columns);
+            matrix::Dense b(n, n, std::make_pair(0, n), range);
+            matrix::Dense c(n, n, std::make_pair(0, n), range);
+            std::fill(b.values.begin(), b.values.end(), 1);
+            double values = a->values.size();
+            // Every value of A reads a row of B and updates a row of C.
+            double bytes = values * (sizeof(double) + sizeof(int)) + values * columns * 3 * sizeof(double);
+            run(parameters("multiply", {{"values_per_row", values_per_row}, {"columns", columns}}),
+                2 * values * columns, bytes, [&]() { matrix::MultiplyAdd(a.get(), &b, &c); });
+        }
+    }
+}
+
+void bench_merge() {
+    const int n = 1 << 12;
+    for (int parts : {2, 8}) {
+        // Blocks of different columns (Merge) and copies of the same columns (MergeSame). The blocks are created
+        // (and the previous result freed) before every run, only the merge is timed.
+        auto partition = matrix::PartitionUniform(n, parts);
+        matrix::Denses ds;
+        std::unique_ptr<matrix::Dense> merged;
+        double bytes = 2.0 * n * n * sizeof(double);
+        run(parameters("merge_columns", {{"n", n}, {"parts", parts}}), 0, bytes,
+            [&]() { merged = matrix::Merge(std::move(ds)); },
+            [&]() {
+                merged.reset();
+                ds.clear();
+                for (int i = 0; i < parts; i++) {
+                    ds.push_back(
+                        std::make_unique<matrix::Dense>(n, n, std::make_pair(partition[i], partition[i + 1])));
+                }
+            });
+        int columns = n / parts;
+        bytes = (parts + 1.0) * n * columns * sizeof(double);
+        run(parameters("merge_same", {{"n", n}, {"parts", parts}}), 0, bytes,
+            [&]() { merged = matrix::MergeSame(std::move(ds)); },
+            [&]() {
+                merged.reset();
+                ds.clear();
+                for (int i = 0; i < parts; i++) {
+                    ds.push_back(std::make_unique<matrix::Dense>(n, n, std::make_pair(0, columns)));
+                }
+            });
+    }
+}
+
+void bench_split() {
+    const int n = 1 << 16;
+    for (int values_per_row : {4, 32}) {
+        auto a = random_sparse(n, values_per_row, 2);
+        double bytes = 2.0 * a->values.size() * (sizeof(double) + sizeof(int));
+        for (bool by_column : {false, true}) {
+            run(parameters(by_column ? "split_columns" : "split_rows",
+                           {{"values_per_row", values_per_row}, {"parts", 16}}),
+                0, bytes, [&]() { a->Split(16, by_column); });
+        }
+        auto b = random_sparse(n, values_per_row, 3);
+        bytes = 2.0 * (a->values.size() + b->values.size()) * (sizeof(double) + sizeof(int));
+        run(parameters("merge_sparse", {{"values_per_row", values_per_row}}), 0, bytes,
+            [&]() { matrix::Sparse(a.get(), b.get()); });
+    }
+}
+
+void bench_parser() {
+    const int n = 1 << 14;
+    for (int values_per_row : {4, 32}) {
+        auto a = random_sparse(n, values_per_row, 4);
+        char path[] = "/tmp/matrixmul_bench-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            throw std::runtime_error("Couldn't create a temporary file.");
+        }
+        close(fd);
+        parser::write_sparse_matrix(path, *a);
+        std::ifstream size(path, std::ifstream::ate | std::ifstream::binary);
+        double bytes = size.tellg();
+        run(parameters("parse_sparse_matrix", {{"values_per_row", values_per_row}}), 0, bytes,
+            [&]() { parser::parse_sparse_matrix(path); });
+        unlink(path);
+    }
+}
+
+void bench_dense_generation() {
+    const int n = 1 << 12;
+    for (int columns : {64, 512}) {
+        for (int batch : {1, 4}) {
+            std::vector<int> seeds(batch);
+            std::iota(seeds.begin(), seeds.end(), 1);
+            double bytes = static_cast<double>(n) * columns * batch * sizeof(double);
+            run(parameters("dense_generation", {{"columns", columns}, {"batch", batch}}), 0, bytes,
+                [&]() { matrix::Dense(n, n, std::make_pair(0, columns), seeds); });
+        }
+    }
+}
+
+void bench_sparse_generation() {
+    const int n = 1 << 16;
+    const std::vector<std::pair<const char *, sparsematgen::Patterns>> patterns = {
+        {"uniform", sparsematgen::UNIFORM}, {"banded", sparsematgen::BANDED},
+        {"rmat", sparsematgen::POWER_LAW}, {"block", sparsematgen::BLOCK_DIAGONAL}};
+    for (const auto &pattern : patterns) {
+        for (int values_per_row : {4, 32}) {
+            sparsematgen::Spec spec;
+            spec.pattern = pattern.second;
+            spec.n = n;
+            spec.values_per_row = values_per_row;
+            double bytes = static_cast<double>(n) * values_per_row * (sizeof(double) + sizeof(int));
+            run(parameters(std::string("sparse_generation/") + pattern.first, {{"values_per_row", values_per_row}}),
+                0, bytes, [&]() { sparsematgen::GenerateRows(spec, 0, n); });
+        }
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        filter = argv[1];
+    }
+    if (argc > 2) {
+        min_seconds = std::strtod(argv[2], nullptr);
+    }
+    bench_multiply();
+    bench_merge();
+    bench_split();
+    bench_parser();
+    bench_dense_generation();
+    bench_sparse_generation();
+    return 0;
+}
@@ -2,8 +2,25 @@
 #define UW_MATRIX_MULTIPLICATION_COMMUNICATOR_H
 
 #include <memory>
+#include <map>
+#include <string>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
 #include "mpi.h"
 #include "matrix.h"
+#include "profile.h"
+
+#ifdef MATRIXMUL_INDEX64
+#define MPI_INDEX_T MPI_INT64_T
+#else
+#define MPI_INDEX_T MPI_INT32_T
+#endif
+
+// Largest number of items sent in a single message (lowered by tests, so that small buffers are split as well).
+#ifndef MATRIXMUL_MAX_MESSAGE_ITEMS
+#define MATRIXMUL_MAX_MESSAGE_ITEMS std::numeric_limits<int>::max()
+#endif
 
 
 namespace messaging {
@@ -13,30 +30,97 @@ private:
     MPI_Comm _comm;
     int _rank;
     int _num_processes;
+    std::map<std::string, std::unique_ptr<Communicator>> _groups;
+
+    // Largest number of items sent in a single message, larger buffers are split into a few of them.
+    static constexpr size_t MAX_MESSAGE_ITEMS = MATRIXMUL_MAX_MESSAGE_ITEMS;
+
+    void send(const void *data, size_t count, MPI_Datatype type, int receiver, int phase);
+    void receive(void *data, size_t count, MPI_Datatype type, int sender, int phase);
+    void broadcast(void *data, size_t count, MPI_Datatype type, int root);
+    void sendReceive(const void *send_data, size_t send_count, void *receive_data, size_t receive_count,
+                     MPI_Datatype type, int sender, int receiver, int phase);
+    void countMessage(profile::Traffic kind, size_t count, MPI_Datatype type);
+    void countAllToAll(const std::vector<int> &send_counts, MPI_Datatype type);
+    // Dense blocks are described by DENSE_META int64 values, whatever the index type: a block of n * (n / p)
+    // doubles may have more than 2^31 of them.
+    static constexpr int DENSE_META = 9;
+    static std::unique_ptr<matrix::Dense> denseFromMeta(const std::int64_t *meta, matrix::Buffer<double> &&values);
 public:
 
     Communicator(int argc, char **argv);
     Communicator(MPI_Comm base_comm, int base_rank, int divider);
+    Communicator(const Communicator &) = delete;
+    Communicator(Communicator &&other) noexcept;
+    Communicator &operator=(const Communicator &) = delete;
     ~Communicator();
 
     Communicator Split(int divider);
+    // Same as Split, but the communicator is created only on the first call with a given name and reused later.
+    // The name identifies the grouping, so every process has to use it with the same rule for the divider.
+    Communicator &Group(const std::string &name, int divider);
 
     bool isCoordinator();
     int rankCoordinator();
     int rank();
     int numProcesses();
+    // Rank of the process among the processes of its node (the ones sharing memory with it) and their number.
+    std::pair<int, int> NodeRank();
 
     void BroadcastSendN(int n);
     int BroadcastReceiveN();
 
+    void BroadcastSendDouble(double value);
+    double BroadcastReceiveDouble();
+
+    void BroadcastSendInts(std::vector<int> &v);
+    std::vector<int> BroadcastReceiveInts(int root);
+
+    double AllReduceMax(double value);
+    void Barrier();
+    // Concatenates texts of all of the processes (in the order of ranks) on the coordinator.
+    std::string GatherChars(const std::string &text);
+    // Reduces the values element by element with the operation, the result is returned to the coordinator.
+    std::vector<double> ReduceDoubles(std::vector<double> &values, MPI_Op op);
+    // Sums the values element by element, the result is returned (in place) to all of the processes.
+    void AllReduceSumDoubles(std::vector<double> &values);
+
+    // Returns the time (in seconds) of sending a single message of a given size to the peer (and back).
+    double PingPong(int peer, int bytes, int repetitions);
+
     void SendN(long n, int receiver, int phase);
     long ReceiveN(int sender, int phase);
 
+    // Combines statistics (element by element) of all of the processes, the result is returned to the coordinator.
+    std::vector<matrix::Statistics> ReduceStatistics(std::vector<matrix::Statistics> &statistics);
+
     void SendDense(matrix::Dense *m, int receiver, int phase);
     std::unique_ptr<matrix::Dense> ReceiveDense(int sender, int phase);
     void BroadcastSendDense(matrix::Dense *m);
     std::unique_ptr<matrix::Dense> BroadcastReceiveDense(int root);
+    void AllReduceSumDense(matrix::Dense *m);
+    // Sums blocks of the same layout, with a panel for every process, of all of the processes. Returns the sum
+    // of the panel 'rank()' (as a block of its columns), so that every process gets a different part of the sum.
+    std::unique_ptr<matrix::Dense> ReduceScatterSumDense(matrix::Dense *m);
+
+    // Collectively writes a batch of matrices into a binary file: a header of three int64 values (rows, columns,
+    // number of matrices), then the matrices one after another, each of them as n_original x n_original doubles
+    // (row-major). Every process writes its own block 'm' (blocks must be disjoint, and may be empty),
+    // its row 'y' is written as the row 'row_order[y]' (the same row if it's out of 'row_order').
+    void WriteDenseFile(const std::string &path, matrix::Dense *m, const std::vector<int> &row_order);
+
+    // Exchanges parts of buffers between all of the processes (part 'i' of the buffer is sent to the process 'i').
+    std::vector<int> AllToAllCounts(std::vector<int> &send_counts);
+    std::vector<int> AllToAllInts(std::vector<int> &send, std::vector<int> &send_counts,
+                                  std::vector<int> &receive_counts);
+    // Received values are often kept as a block of a matrix, so they are received into a matrix buffer.
+    matrix::Buffer<double> AllToAllDoubles(std::vector<double> &send, std::vector<int> &send_counts,
+                                           std::vector<int> &receive_counts);
 
+    // Sends 'm' to the receiver and replaces it with the matrix received from the sender. The matrix is received
+    // into 'buffer', which is swapped with 'm', so nothing is allocated if the buffer has enough capacity.
+    void ShiftSparse(std::unique_ptr<matrix::Sparse> &m, std::unique_ptr<matrix::Sparse> &buffer, int sender,
+                     int receiver, int phase);
     void SendSparse(matrix::Sparse *m, int receiver, int phase);
     std::unique_ptr<matrix::Sparse> ReceiveSparse(int sender, int phase);
     void BroadcastSendSparse(matrix::Sparse *m);
@@ -1,41 +1,111 @@
 #ifndef UW_MATRIX_MULTIPLICATION_MATRIX_H
 #define UW_MATRIX_MULTIPLICATION_MATRIX_H
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
 #include <memory>
 #include <vector>
 #include <iostream>
+#include <limits>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include "densematgen.h"
+#include "numa.h"
 
 
 namespace matrix {
 
+// Type of offsets of rows and numbers of values of sparse matrices (column indices stay 'int').
+// Positions in blocks of dense matrices are always 'size_t'.
+#ifdef MATRIXMUL_INDEX64
+using index_t = std::int64_t;
+#else
+using index_t = std::int32_t;
+#endif
+
+// Converts a number of values (or an offset of a row) of a sparse matrix to 'index_t'. Throws if it doesn't fit
+// (the program has to be configured with MATRIXMUL_INDEX64 for such matrices).
+index_t ToIndex(size_t items);
+
+// Buffer of values (or indices) of a matrix, placed as described in numa.h.
+template <typename T>
+using Buffer = std::vector<T, numa::Allocator<T>>;
+
+// Partition of the range [0, width) into consecutive parts.
+// Part `i` owns the range [partition[i], partition[i+1]).
+using Partition = std::vector<int>;
+
+// Splits the range into parts of (almost) equal width.
+Partition PartitionUniform(int width, int parts);
+// Splits the range into parts carrying (almost) equal sum of weights.
+Partition PartitionBalanced(const std::vector<long> &weights, int parts);
+// Returns the ratio between the heaviest part and the mean part weight.
+double PartitionImbalance(const std::vector<long> &weights, const Partition &partition);
+// Returns the part owning the given index.
+int PartitionOwner(const Partition &partition, int index);
+
 class Dense {
 public:
     int n_original;
-    // MatrixDense contains a given number of full columns.
-    int rows;           // Number of rows in the Matrix (=n).
+    // MatrixDense contains a given number of full columns (or their block of rows).
+    int rows;           // Number of rows saved in the Matrix (=n, unless it's a block of rows).
+    int row_base = 0;   // First row saved in the Matrix.
     int column_base;    // First column saved in the Matrix.
     int columns;        // Number of columns saved in the Matrix.
     int columns_total;  // Total number of columns in the Matrix.
-    std::vector<double> values;
+    // Matrix may hold the same block of a batch of matrices: every row stores the row of each of them (one by one).
+    int batch = 1;
+    // Layout of the values: the block is a sequence of panels, the panel 'i' holds the columns
+    // [panels[i], panels[i+1]). Panels are stored one after another, each of them row-major (as described above).
+    // A merged block keeps the blocks it was merged from as its panels, so that merges, sends and gathers copy
+    // whole buffers, while the kernel still reads rows (of every panel) contiguously. A plain row-major block
+    // is a single panel.
+    Partition panels;
+    Buffer<double> values;
 
     // Creates new Dense matrix filled with random values.
     Dense(int n, int n_original, int part, int parts_total, int seed);
     // Creates new Dense matrix filled with zeroes.
     Dense(int n, int n_original, int part, int parts_total);
     // Creates new Dense matrix based on provided values.
-    Dense(int n, int n_original, int column_base, int columns, int columns_total, std::vector<double> &&values);
+    Dense(int n, int n_original, int column_base, int columns, int columns_total, Buffer<double> &&values);
     // Creates new Dense matrix within provided column range filled with zeroes.
     Dense(int n, int n_original, std::pair<int, int> column_range);
+    // Creates new batch of Dense matrices (one for each seed) within provided column range filled with random values.
+    Dense(int n, int n_original, std::pair<int, int> column_range, const std::vector<int> &seeds);
+    // Creates new Dense block (or a batch of them) of provided rows and columns filled with zeroes.
+    Dense(int n, int n_original, std::pair<int, int> row_range, std::pair<int, int> column_range, int batch = 1);
 
     std::pair<int, int> ColumnRange();
-    double Get(int x, int y);
-    void Set(int x, int y, double value);
+    std::pair<int, int> RowRange();
+    int Panels() const { return static_cast<int>(panels.size()) - 1; }
+    // Index of the first value of the panel.
+    size_t PanelOffset(int panel) const {
+        return static_cast<size_t>(rows) * batch * (panels[panel] - column_base);
+    }
+    // Returns a block of the same rows, columns and layout filled with zeroes.
+    std::unique_ptr<Dense> ZerosLike() const;
+    // Returns a copy of the panel (as a block of its columns).
+    std::unique_ptr<Dense> Panel(int panel) const;
+    double Get(int x, int y, int batch_index = 0);
+    void Set(int x, int y, double value, int batch_index = 0);
     void ItemAdd(int x, int y, double value);
+    // Returns a copy of a single matrix of the batch.
+    std::unique_ptr<Dense> Extract(int batch_index);
+    // Reorders rows, so that the row 'i' becomes the row 'permutation[i]' of the matrix.
+    // Rows not covered by the permutation stay in place.
+    void PermuteRows(const std::vector<int> &permutation);
 
 private:
-    size_t valuesIndex(int x, int y);
+    size_t valuesIndex(int x, int y, int batch_index);
 };
 
 using Denses = std::vector<std::unique_ptr<Dense>>;
@@ -45,27 +115,118 @@ std::unique_ptr<Dense> Merge(Denses &&ds);
 std::unique_ptr<Dense> MergeSame(Denses &&ds);
 
 std::ostream& operator<<(std::ostream &os, const Dense &m);
+// Writes the matrix the same way as operator<< (values with 5 significant digits separated by tabs), but into
+// a file with large buffered writes. Blocks of rows are formatted by a few threads and written in order.
+void Print(const Dense &m, FILE *file);
 
 class Sparse {
 public:
     int n;
+    int row_base = 0; // Row of the first offset (a block of rows, e.g. a chunk of the matrix streamed from disk).
 
-    std::vector<double> values;             // Values in the matrix.
-    std::vector<int> rows_number_of_values; // Separation of values to different rows.
-    std::vector<int> values_column;         // Values' column indices.
+    Buffer<double> values;                  // Values in the matrix.
+    Buffer<index_t> rows_number_of_values;  // Separation of values to different rows.
+    Buffer<int> values_column;              // Values' column indices.
 
     // Creates new Sparse matrix based on provided values.
-    Sparse(int n, std::vector<double> &&values, std::vector<int> &&rows_number_of_values,
-                 std::vector<int> &&values_column);
+    Sparse(int n, Buffer<double> &&values, Buffer<index_t> &&rows_number_of_values, Buffer<int> &&values_column);
     // Creates new Sparse matrix as a result from merging two provided ones.
     Sparse(Sparse *a, Sparse *b);
 
     // Splits the matrix into a 'processes' number of matrices. You may choose the dimension to split.
     std::vector<Sparse> Split(int processes, bool split_by_column);
+    // Creates new Sparse matrix from coordinates of values (row0, column0, row1, column1, ...).
+    Sparse(int n, const std::vector<int> &coordinates, const Buffer<double> &values);
+
+    // Splits the matrix into parts defined by the partition of rows or columns.
+    std::vector<Sparse> Split(const Partition &partition, bool split_by_column);
+
+    // Number of values in each row or column.
+    std::vector<long> ValuesPerRow();
+    std::vector<long> ValuesPerColumn();
 };
 
 std::ostream& operator<<(std::ostream &os, const Sparse &m);
 
+// Rows of C written during the current multiplication. With it, C doesn't have to be zeroed before the
+// multiplication: the first contribution to a row overwrites it and rows without any are zeroed at the end.
+class RowEpochs {
+public:
+    std::vector<int> epoch; // Epoch of the last write to each row of C.
+    int current = 0;
+
+    // Starts a new multiplication into a matrix with a given number of rows (all rows become stale).
+    void Next(int rows);
+    // Returns true if the row is written for the first time in the current epoch (and marks it as written).
+    bool First(int row) {
+        if (epoch[row] == current) {
+            return false;
+        }
+        epoch[row] = current;
+        return true;
+    }
+};
+
+// Adds the product of 'a' and 'b' to 'c' (c += a * b). Matrices 'b' and 'c' must store the same columns,
+// rows of 'b' and 'c' must cover columns and rows of values in 'a' (shifted by its row base).
+// With 'epochs', rows of 'c' not written in the current epoch are overwritten instead (c = a * b).
+void MultiplyAdd(Sparse *a, Dense *b, Dense *c, RowEpochs *epochs = nullptr);
+// Same as MultiplyAdd, but 'a' stores only the upper triangle of a symmetric matrix: every value (i, j) is
+// applied to both (i, j) and (j, i). Rows of 'b' and 'c' must cover rows and columns of values in 'a'.
+void MultiplyAddSymmetric(Sparse *a, Dense *b, Dense *c, RowEpochs *epochs = nullptr);
+// Zeroes rows of 'c' which weren't written in the current epoch.
+void ZeroStaleRows(Dense *c, const RowEpochs &epochs);
+
+// Histogram of values in [low, high) split into 'bins' bins of equal width (other values aren't counted).
+struct HistogramRange {
+    double low = 0;
+    double high = 0;
+    int bins = 0;
+};
+const int MAX_HISTOGRAM_BINS = 256;
+
+// Statistics of values of a matrix, partial statistics of its parts are combined with Combine.
+// It is a plain structure, so that it can be reduced with a single MPI datatype.
+struct Statistics {
+    long ge_count = 0; // Values greater or equal to a given one.
+    long count = 0;
+    double min = INFINITY;
+    double max = -INFINITY;
+    double sum = 0;
+    double sum_squares = 0;
+    long histogram[MAX_HISTOGRAM_BINS] = {};
+
+    void Combine(const Statistics &other);
+    // Adds a given number of zeroes.
+    void AddZeros(long zeros, double g, const HistogramRange &histogram);
+};
+
+// Returns statistics of non-zero values of every matrix of the batch stored in 'm' (in a single pass).
+// Zeroes are skipped, so that results spread over processes which hold zeroes in place of values computed by
+// the others can be combined, the missing zeroes are added at the end (see AddZeros).
+// Only the original rows and columns (the ones below 'n_original') are taken into account.
+std::vector<Statistics> BatchStatistics(Dense *m, double g, const HistogramRange &histogram);
+
+// Quantities of a single column of C and B used by the power iteration (see AddColumnMoments).
+enum Moments { C_C, C_B, B_B, RESIDUAL, MOMENTS };
+
+// Adds moments of the columns of 'c' and 'b' (blocks of the same rows, columns and layout), computed in a single
+// pass: for the column x of the matrix s of the batch, moments[MOMENTS * (x * batch + s) + i] gets c.c, c.b, b.b
+// and r.r, where r = c - shifts[x * batch + s] * b. Only the original rows and columns are taken into account.
+void AddColumnMoments(Dense *b, Dense *c, const std::vector<double> &shifts, std::vector<double> &moments);
+// Multiplies the column x of the matrix s of the batch by scales[x * batch + s].
+void ScaleColumns(Dense *m, const std::vector<double> &scales);
+// Adds the product of 'm' and the vector 'x' (indexed by columns of the whole matrix) to 'y', indexed by rows of
+// the whole matrix: the product of the matrix s of the batch is added to y[row * batch + s].
+void MultiplyAddVector(Dense *m, const std::vector<double> &x, double *y);
+
+// Returns true if the matrix is equal to its transposition.
+bool IsSymmetric(Sparse *m);
+// Returns values of the matrix on and above the diagonal.
+std::unique_ptr<Sparse> UpperTriangle(Sparse *m);
+// Time (in seconds) of the local multiplication of the matrix by a dense panel of a given width.
+double MultiplyTime(Sparse *m, int columns);
+
 class SparseIt {
 public:
     explicit SparseIt(Sparse *m);
@@ -74,9 +235,9 @@ public:
     bool Next();
 private:
     Sparse *_m;
-    int i = -1;
+    index_t i = -1;
     int r = -1;
-    int _values_in_row = 0;
+    index_t _values_in_row = 0;
 };
 
 }
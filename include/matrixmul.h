@@ -3,8 +3,13 @@
 
 #include <memory>
 #include <cassert>
+#include <random>
 #include "matrix.h"
 #include "communicator.h"
+#include "reorder.h"
+#include "outofcore.h"
+#include "sparsematgen.h"
+#include "profile.h"
 
 // MKL - matrix multiplication of sparse and dense matrix.
 // https://software.intel.com/en-us/mkl-developer-reference-fortran-mkl-sparse-mm
@@ -19,6 +24,30 @@ namespace matrixmul {
 enum Algorithms {
     COLA,   // 1.5D blocked column replicating A (ColA)
     COLABC, // 1.5D blocked column replicating all matrices (ColABC)
+    COLB,   // 1.5D blocked column replicating B and C, shifting A (ColB)
+    SUMMA,  // 2D SUMMA on a grid of processes, 2.5D / 3D with c > 1 layers of the grid
+    SPARSE1D, // 1D split of rows of all matrices, only rows of B referenced by the local A are exchanged
+};
+
+enum Symmetry {
+    GENERAL,   // A is stored as a whole.
+    SYMMETRIC, // A is declared symmetric, only its upper triangle is stored.
+    DETECT,    // Only the upper triangle is stored if A turns out to be symmetric.
+};
+
+// Returns the replication groups of the process in InnerABC: the group of B and C (consecutive ranks) and
+// the group of A.
+std::pair<int, int> group_divider(int rank, int replication_group_size, int processes);
+
+// Options shared by all of the algorithms.
+struct Options {
+    bool balanced = false; // Split A so that every process gets (almost) the same number of non-zero values.
+    reorder::Methods reordering = reorder::NONE; // Reorder rows and columns of A before the distribution.
+    Symmetry symmetry = GENERAL;
+    double memory_budget = 0; // Memory (in bytes) for blocks of A, if > 0 A is streamed from scratch files.
+    sparsematgen::Spec generator; // If its n > 0, every process generates its own block of A (there is no full A).
+    bool power_iteration = false; // Normalize columns of C after every multiplication, stop once they converge.
+    double tolerance = 0;         // Largest residual of a column at which the power iteration stops.
 };
 
 class Algorithm {
@@ -27,42 +56,171 @@ public:
     int n;
     int c;
 
+    matrix::Partition partitionA; // Rows or columns of A assigned to the processes in the initial distribution.
+    matrix::Partition partitionB; // Columns of B (and C) assigned to the processes in the initial distribution.
+    std::vector<int> permutation; // Reordering of rows and columns of A (empty if A is not reordered).
+    bool symmetric = false;       // Only the upper triangle of (symmetric) A is stored.
+
     messaging::Communicator *communicator;
 
     std::unique_ptr<matrix::Sparse> matrixA;
     std::unique_ptr<matrix::Dense> matrixB;
     std::unique_ptr<matrix::Dense> matrixC;
+    std::unique_ptr<matrix::Dense> matrixResults; // Results for the whole batch of seeds (see selectResult).
+
+    // Workspace reused by all of the rounds (and jobs).
+    std::unique_ptr<matrix::Sparse> bufferA; // The second ring buffer of A, allocated on the first shift.
+    matrix::RowEpochs epochsC;               // Rows of C written in the current multiplication.
+
+    // Out-of-core mode: A is kept in a scratch file and streamed in chunks of at most 'chunk_values' values.
+    size_t chunk_values = 0;
+    std::shared_ptr<outofcore::SpilledSparse> spilledA;
+
+    // Power iteration: columns of C are normalized after every multiplication, and the computation stops before
+    // the given exponent once the residual of every column drops below the tolerance.
+    bool power_iteration = false;
+    double tolerance = 0;
+    int iterations = 0;           // Multiplications done by the last phaseComputation.
+    double residual = 0;          // Largest residual of a column after the last of them.
+    std::vector<double> rayleigh; // Rayleigh quotients of the columns of the previous iterate.
+    int copiesA = 1;              // Processes holding every value of A (after the replication).
 
     Algorithm(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com, int replication_factor,
-              int seed, bool split_by_columns);
+              const std::vector<int> &seeds, bool split_by_columns, const Options &options);
 
     virtual void phaseReplication() = 0;
+    // Part of the replication concerning B and C (A is replicated once and reused by the following jobs).
+    virtual void phaseReplicationB() = 0;
     virtual void phaseComputation(int power) = 0;
     virtual void phaseFinalMatrix() = 0;
-    void phaseFinalGE(double g);
+    // Returns statistics of the results of the whole batch (to the coordinator), computed in a single pass
+    // over the local blocks of C and combined with a single reduction. C is never gathered.
+    std::vector<matrix::Statistics> phaseFinalStatistics(double g, const matrix::HistogramRange &histogram);
+    // Writes the results of the whole batch into a binary file (see Communicator::WriteDenseFile) with a single
+    // collective write, every process writes its own block of C.
+    void phaseFinalFile(const std::string &path);
+    // Prepares the next job on the same A: generates B for the given seeds and replicates it.
+    void phaseNextJob(const std::vector<int> &seeds);
+    // Makes C the result for a given seed of the batch (final phases operate on a single result).
+    void selectResult(int batch_index);
+    // Freivalds' check of C = A^power * B (for the batch generated from the seeds), without gathering C: for a random
+    // vector x, compares C * x with A^power * (B * x) computed by products of the local blocks of A and vectors.
+    // Returns (on every process) the relative error ||C * x - A^power * B * x|| / ||A^power * B * x|| (maximum
+    // norms) of every matrix of the batch. C has to be in the initial distribution (after phaseComputation).
+    std::vector<double> phaseVerify(const std::vector<int> &seeds, int power);
+
+    void printFinalMatrix(std::unique_ptr<matrix::Dense> m);
 
     void phaseComputationPartial();
     void phaseComputationCycleA(messaging::Communicator *comm);
+
+protected:
+    // Local multiplication (c += a * b) of a block of A, taking the symmetric storage into account.
+    void multiplyAdd(matrix::Sparse *a, matrix::Dense *b, matrix::Dense *c);
+    // Gathers blocks of A of all of the processes of the group (in memory or in a scratch file).
+    void replicateA(messaging::Communicator &comm);
+    // Generates the block of A of this process (uniformly split), exchanging values with an all-to-all
+    // if A is split by columns (blocks of rows are generated).
+    void generateA(const sparsematgen::Spec &spec, bool split_by_columns);
+    // Returns the block of B of this process in the initial distribution (reordered like A).
+    std::unique_ptr<matrix::Dense> initialB(const std::vector<int> &seeds);
+    // Generates B (and an empty C) in the initial distribution.
+    void generateB(const std::vector<int> &seeds);
+    // Adds the product of the block of A held by this process and 'b' to 'c' (blocks of all of the rows).
+    virtual void multiplyLocalA(matrix::Dense *b, matrix::Dense *c);
+    // Combines the results of a replication group holding C with a panel for every member: sums up their partial
+    // results with a single reduce-scatter (or, if C is a copy of B, takes the panel), so that every member keeps
+    // a different block of columns of the result (the block of C of the initial distribution).
+    void scatterResult(messaging::Communicator &group, bool partial);
+    // Power iteration after the multiplication 'step' (C = A * B, B is the previous iterate): normalizes columns of C
+    // and computes their residuals ||C - l * B|| / ||C|| (l is the Rayleigh quotient of the previous step), using
+    // a single pass over B and C and a single reduction. Every value of C is held by 'copies' processes.
+    // Returns true if the iteration has converged.
+    bool normalizeStep(int step, int copies);
 };
 
 class AlgorithmCOLA : public Algorithm {
 public:
     AlgorithmCOLA(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com, int replication_factor,
-        int seed);
+        const std::vector<int> &seeds, const Options &options);
 
     void phaseReplication() override;
+    void phaseReplicationB() override;
     void phaseComputation(int power) override;
     void phaseFinalMatrix() override;
 };
 
 class AlgorithmInnerABC : public Algorithm {
 public:
+    std::unique_ptr<matrix::Sparse> matrixAInitial; // Block of A before the first shift.
+    std::shared_ptr<outofcore::SpilledSparse> spilledAInitial;
+
     AlgorithmInnerABC(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com, int replication_factor,
-        int seed);
+        const std::vector<int> &seeds, const Options &options);
+
+    void phaseReplication() override;
+    void phaseReplicationB() override;
+    void phaseComputation(int power) override;
+    void phaseFinalMatrix() override;
+};
+
+class AlgorithmCOLB : public Algorithm {
+public:
+    AlgorithmCOLB(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com, int replication_factor,
+        const std::vector<int> &seeds, const Options &options);
+
+    void phaseReplication() override;
+    void phaseReplicationB() override;
+    void phaseComputation(int power) override;
+    void phaseFinalMatrix() override;
+};
+
+class AlgorithmSUMMA : public Algorithm {
+public:
+    int q;                          // Processes are organized into c layers of q x q grids.
+    int layer;
+    int grid_row;
+    int grid_column;
+    matrix::Partition partitionGrid; // Rows / columns of A, B and C assigned to the rows / columns of the grid.
+
+    AlgorithmSUMMA(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com, int replication_factor,
+        const std::vector<int> &seeds, const Options &options);
+
+    void phaseReplication() override;
+    void phaseReplicationB() override;
+    void phaseComputation(int power) override;
+    void phaseFinalMatrix() override;
+
+private:
+    int gridRank(int l, int i, int j);
+    void redistributeAToGrid();
+    void redistributeBToGrid();
+    void redistributeFromGrid();
+};
+
+class AlgorithmSparse1D : public Algorithm {
+public:
+    // Communication plan (built once): numbers of rows of B received from / sent to every process
+    // and rows sent by this process (grouped by the receiver).
+    std::vector<int> receiveRows;
+    std::vector<int> sendRows;
+    std::vector<int> sendRowIndices;
+    std::vector<int> requiredRows; // Rows of B referenced by the local block of A (its renumbered columns).
+
+    AlgorithmSparse1D(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com,
+        int replication_factor, const std::vector<int> &seeds, const Options &options);
 
     void phaseReplication() override;
+    void phaseReplicationB() override;
     void phaseComputation(int power) override;
     void phaseFinalMatrix() override;
+
+protected:
+    void multiplyLocalA(matrix::Dense *b, matrix::Dense *c) override;
+
+private:
+    void redistributeToRows();
+    void redistributeToColumns();
 };
 
 }
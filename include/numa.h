@@ -0,0 +1,86 @@
+#ifndef UW_MATRIX_MULTIPLICATION_NUMA_H
+#define UW_MATRIX_MULTIPLICATION_NUMA_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+
+// Placement of the buffers of matrices in memory. Buffers are aligned to cache lines, large ones may be backed by
+// huge pages. Pages are placed by the first touch (the zero-filling or copying constructor of the buffer), so with
+// processes pinned to cores (see Pin) every process places its blocks on its own NUMA node.
+namespace numa {
+
+enum HugePages {
+    NO_HUGE_PAGES,
+    TRANSPARENT, // Large buffers are aligned to huge pages and advised to be backed by them (madvise).
+    EXPLICIT,    // Large buffers are mapped from the pool of huge pages (MAP_HUGETLB), or transparent if it's empty.
+};
+
+enum Affinity {
+    NO_AFFINITY,
+    COMPACT, // Processes of a node get consecutive blocks of its cores.
+    SPREAD,  // Processes of a node get every k-th core (neighbouring ranks land on different sockets).
+};
+
+// Alignment of every buffer: a cache line, so that SIMD loads of rows never cross two of them.
+const size_t ALIGNMENT = 64;
+// Buffers of at least this many bytes may be backed by huge pages.
+const size_t HUGE_PAGE_BYTES = 2 << 20;
+
+// Counters of the buffers of this process (updated by all of its threads).
+struct Allocations {
+    std::atomic<long> count{0};          // Buffers allocated.
+    std::atomic<long> bytes{0};          // Bytes currently allocated.
+    std::atomic<long> peak_bytes{0};
+    std::atomic<long> huge_bytes{0};     // Bytes of all of the buffers allocated with huge pages.
+    std::atomic<long> huge_fallbacks{0}; // EXPLICIT buffers which fell back to transparent huge pages.
+};
+
+Allocations &Stats();
+
+// Sets the huge pages used by the following allocations (no huge pages by default).
+void SetHugePages(HugePages mode);
+
+void *Allocate(size_t bytes);
+void Free(void *pointer);
+
+// Allocator of buffers of matrices, with the placement described above.
+template <typename T>
+class Allocator {
+public:
+    using value_type = T;
+
+    Allocator() = default;
+    template <typename U>
+    Allocator(const Allocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(Allocate(n * sizeof(T)));
+    }
+    void deallocate(T *pointer, size_t) noexcept {
+        Free(pointer);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const Allocator<T> &, const Allocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const Allocator<T> &, const Allocator<U> &) {
+    return false;
+}
+
+// Pins the process to a share of the cores available to it (its threads inherit it), as the process
+// 'local_rank' of 'local_size' processes of the node. Returns the cores it is pinned to.
+std::vector<int> Pin(Affinity affinity, int local_rank, int local_size);
+// Returns a description of the cores of the process and their NUMA nodes, e.g. "cores 0-3 (node 0)".
+std::string DescribeAffinity();
+
+}
+
+#endif //UW_MATRIX_MULTIPLICATION_NUMA_H
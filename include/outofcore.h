@@ -0,0 +1,69 @@
+#ifndef UW_MATRIX_MULTIPLICATION_OUTOFCORE_H
+#define UW_MATRIX_MULTIPLICATION_OUTOFCORE_H
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <future>
+#include <functional>
+#include <stdexcept>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include "matrix.h"
+#include "communicator.h"
+
+
+namespace outofcore {
+
+// Sparse matrix kept in a scratch file as a sequence of chunks (blocks of consecutive rows in the CSR format).
+// Chunks may overlap (e.g. when blocks of a few processes are appended), values of the matrix are their sum.
+class SpilledSparse {
+public:
+    int n;
+
+    // Creates an empty matrix in a new scratch file (in $TMPDIR or /tmp).
+    // Chunks hold at most 'chunk_values' values (unless a single row has more of them).
+    SpilledSparse(int n, size_t chunk_values);
+    SpilledSparse(const SpilledSparse &) = delete;
+    SpilledSparse &operator=(const SpilledSparse &) = delete;
+    // Removes the scratch file.
+    ~SpilledSparse();
+
+    // Splits the matrix into chunks and writes them.
+    void Append(matrix::Sparse *m);
+    // Writes the chunk as it is.
+    void AppendChunk(matrix::Sparse *chunk);
+
+    size_t Chunks() const;
+    size_t ChunkValues() const;
+    size_t Values() const;
+    std::unique_ptr<matrix::Sparse> ReadChunk(size_t index) const;
+    // Calls 'f' for every chunk, reading the next one in the background.
+    void ForEachChunk(const std::function<void(matrix::Sparse *)> &f) const;
+
+private:
+    struct Chunk {
+        int row_base;
+        int rows;
+        size_t values;
+        off_t offset;
+    };
+
+    size_t _chunk_values;
+    int _fd;
+    off_t _size = 0;
+    std::vector<Chunk> _chunks;
+};
+
+// Sends the matrix to the receiver chunk by chunk and returns the one received from the sender.
+// Only a few chunks are kept in memory at any time.
+std::unique_ptr<SpilledSparse> Shift(messaging::Communicator *comm, SpilledSparse *m, int sender, int receiver,
+                                     int phase);
+// Returns the matrices of all of the processes of the group (in the order of ranks), broadcast chunk by chunk.
+// Only a few chunks are kept in memory at any time.
+std::unique_ptr<SpilledSparse> AllGather(messaging::Communicator *comm, SpilledSparse *m);
+
+}
+
+#endif //UW_MATRIX_MULTIPLICATION_OUTOFCORE_H
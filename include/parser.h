@@ -1,12 +1,18 @@
 #ifndef UW_MATRIX_MULTIPLICATION_PARSER_H
 #define UW_MATRIX_MULTIPLICATION_PARSER_H
 
+#include <algorithm>
+#include <climits>
 #include <memory>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <getopt.h>
 #include "matrixmul.h"
+#include "numa.h"
+#include "sparsematgen.h"
 
 
 namespace parser {
@@ -15,18 +21,58 @@ class Arguments {
 public:
 
     std::string sparse_matrix_file;
-    int seed = 0;
+    sparsematgen::Spec generator; // A generated by every process instead of being read (if its n > 0).
+    std::string dump_file;        // File the generated A is written into (in the format of sparse_matrix_file).
+    std::vector<int> seeds;     // Seeds of the dense matrices B multiplied together (as a single batch).
     matrixmul::Algorithms algorithm = matrixmul::COLA;
+    bool auto_tune = false;     // Choose the algorithm and the replication group size automatically.
+    double memory_cap = 0;      // Memory (in bytes) available to a single process for auto-tuning, 0 if unlimited.
     bool print_the_matrix_c = false;
     int replication_group_size = 1;
     int exponent = 0;
     double ge_value = 0;
+    bool power_iteration = false; // Normalize C after every multiplication, the exponent is the limit of them.
+    double tolerance = 0;         // The power iteration stops once the residual of every column is below it.
     bool mkl = false;
+    bool balanced = false;
+    reorder::Methods reordering = reorder::NONE;
+    matrixmul::Symmetry symmetry = matrixmul::GENERAL;
+    double memory_budget = 0;   // Memory (in bytes) for blocks of A in the out-of-core mode, 0 if A is in memory.
+    bool report_memory = false; // Report the peak resident memory of the processes.
+    bool verify = false;        // Check C with Freivalds' algorithm (without gathering it).
+    numa::Affinity affinity = numa::NO_AFFINITY; // Cores the processes of a node are pinned to.
+    numa::HugePages huge_pages = numa::NO_HUGE_PAGES; // Huge pages backing large buffers of matrices.
+    std::string jobs_file;      // Serve jobs read from this file / FIFO ("-" for stdin) instead of a single run.
+    std::string profile_file;   // File the measurements of the phases are written into as JSON ("-" for stderr).
+    std::string trace_file;     // File the timeline of events of all of the processes is written into.
+    std::string output_file;    // Binary file the results are written into (with a collective write).
+    std::vector<std::string> statistics; // Statistics of C printed instead of C (min, max, sum, mean, norm).
+    matrix::HistogramRange histogram;     // Histogram of values of C printed instead of C (if it has any bins).
 
     Arguments(int argc, char **argv);
 };
 
+// A single request of the job-server mode, given as a line: "seeds exponent [-g ge_value | -v]".
+struct Job {
+    std::vector<int> seeds;
+    int exponent = 0;
+    double ge_value = 0;
+    bool print_the_matrix_c = false;
+};
+
+std::vector<int> parse_seeds(const std::string &list);
+// Parses a list of statistics, e.g. "min,max,norm".
+std::vector<std::string> parse_statistics(const std::string &list);
+// Parses a histogram given as "low:high:bins".
+matrix::HistogramRange parse_histogram(const std::string &range);
+// Parses a generated A given as "pattern:n:values_per_row[:seed]".
+sparsematgen::Spec parse_generator(const std::string &spec);
+// Returns false if the line isn't a valid job.
+bool parse_job(const std::string &line, Job &job);
+
 std::unique_ptr<matrix::Sparse> parse_sparse_matrix(const std::string &filename);
+// Writes the matrix in the format read by parse_sparse_matrix.
+void write_sparse_matrix(const std::string &filename, const matrix::Sparse &m);
 
 }
 
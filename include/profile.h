@@ -0,0 +1,137 @@
+#ifndef UW_MATRIX_MULTIPLICATION_PROFILE_H
+#define UW_MATRIX_MULTIPLICATION_PROFILE_H
+
+#include <ostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include "mpi.h"
+
+
+namespace messaging {
+class Communicator;
+}
+
+namespace profile {
+
+// Phases of a run measured by the timers. Timers of the rounds (MULTIPLY, SHIFT, COMBINE) are nested
+// in COMPUTATION.
+enum Timer {
+    DISTRIBUTION, // Reading is not included: splitting and sending the initial blocks (Algorithm constructor).
+    REPLICATION,  // phaseReplication (and phaseNextJob in the job-server mode).
+    COMPUTATION,  // phaseComputation.
+    MULTIPLY,     // Local multiplications (phaseComputationPartial and its equivalents).
+    SHIFT,        // Exchanges of blocks of A (or B) between the rounds (phaseComputationCycleA and its equivalents).
+    COMBINE,      // Reductions of partial results of C between the multiplications.
+    FINAL,        // Final phases: statistics, the output file and gathering C.
+    TIMERS
+};
+
+// Kinds of communication counted by the communicators.
+enum Traffic {
+    POINT_TO_POINT, // Messages sent (shifts count the sent half only).
+    BROADCAST,      // Messages broadcast by the root (counted once, on the root).
+    REDUCTION,      // Contributions of the process to reductions.
+    ALL_TO_ALL,     // Parts sent to the other processes in all-to-all exchanges.
+    TRAFFIC_KINDS
+};
+
+// Measurements of this process. Timers are always on: a call of MPI_Wtime costs far less than the phases.
+struct Measurements {
+    double seconds[TIMERS] = {};
+    long calls[TIMERS] = {};
+    long messages[TRAFFIC_KINDS] = {};
+    long bytes[TRAFFIC_KINDS] = {};
+};
+
+Measurements &Local();
+
+inline void CountMessage(Traffic kind, size_t bytes) {
+    Local().messages[kind]++;
+    Local().bytes[kind] += static_cast<long>(bytes);
+}
+
+// Timeline of events of this process (opt-in). Events are kept in a ring buffer (the oldest ones are overwritten
+// when it is full) filled without locks, so that threads of the process can record events too.
+struct TraceEvent {
+    const char *name;
+    double begin;
+    double end;
+    int step;  // Multiplication (step of the exponent) the event belongs to, -1 outside of the computation.
+    int round; // Round of the multiplication, -1 outside of the rounds.
+};
+
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<size_t> recorded{0};
+    double start = 0;
+    int step = -1;
+    int round = -1;
+};
+
+// Disabled tracing costs a single check of this flag per event.
+extern bool tracing;
+TraceBuffer &Trace();
+
+// Starts recording (at most 'capacity' last events). Time is measured from a barrier of all of the processes.
+void StartTrace(messaging::Communicator *comm, size_t capacity);
+// Sets the position within the computation attached to the following events.
+inline void SetPosition(int step, int round) {
+    if (tracing) {
+        Trace().step = step;
+        Trace().round = round;
+    }
+}
+// Gathers events of all of the processes and writes them (on the coordinator) as a Chrome trace / Perfetto JSON
+// file, with a track for every process.
+void WriteTrace(messaging::Communicator *comm, const std::string &path);
+
+// Records the time between its construction and destruction as an event (if tracing is on).
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : _name{tracing ? name : nullptr}, _begin{tracing ? MPI_Wtime() : 0} {}
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+    ~TraceScope() {
+        if (_name != nullptr) {
+            auto &trace = Trace();
+            size_t i = trace.recorded.fetch_add(1, std::memory_order_relaxed);
+            trace.events[i % trace.events.size()] = {_name, _begin, MPI_Wtime(), trace.step, trace.round};
+        }
+    }
+
+private:
+    const char *_name;
+    double _begin;
+};
+
+extern const char *const TIMER_NAMES[TIMERS];
+
+// Adds the time between its construction and destruction to the timer (and records it as an event).
+class Scope {
+public:
+    explicit Scope(Timer timer) : _timer{timer}, _start{MPI_Wtime()}, _trace{TIMER_NAMES[timer]} {}
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() {
+        Local().seconds[_timer] += MPI_Wtime() - _start;
+        Local().calls[_timer]++;
+    }
+
+private:
+    Timer _timer;
+    double _start;
+    TraceScope _trace;
+};
+
+// Writes min, max and mean (over all of the processes) of every measurement as JSON (on the coordinator).
+// Words are 8-byte words, the unit of communication volume of the cost model of the 1.5D algorithms.
+void Report(messaging::Communicator *comm, std::ostream &os);
+
+}
+
+#endif //UW_MATRIX_MULTIPLICATION_PROFILE_H
@@ -0,0 +1,35 @@
+#ifndef UW_MATRIX_MULTIPLICATION_REORDER_H
+#define UW_MATRIX_MULTIPLICATION_REORDER_H
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <queue>
+#include <numeric>
+#include "matrix.h"
+
+
+namespace reorder {
+
+enum Methods {
+    NONE,   // Keep the original order of rows and columns.
+    RCM,    // Reverse Cuthill-McKee.
+    DEGREE, // Rows sorted by the number of neighbours.
+};
+
+// Returns a permutation of rows (and columns) reducing the bandwidth of the matrix.
+// Row 'i' of the reordered matrix is the row 'permutation[i]' of the original one.
+std::vector<int> Permutation(matrix::Sparse *m, Methods method);
+std::vector<int> PermutationInverse(const std::vector<int> &permutation);
+
+// Returns P * m * P^T, i.e. the matrix with both rows and columns reordered.
+std::unique_ptr<matrix::Sparse> Permute(matrix::Sparse *m, const std::vector<int> &permutation);
+
+// Maximal distance of a non-zero value from the diagonal.
+long Bandwidth(matrix::Sparse *m);
+// Sum of distances between the diagonal and the first non-zero value in each row.
+long Profile(matrix::Sparse *m);
+
+}
+
+#endif //UW_MATRIX_MULTIPLICATION_REORDER_H
@@ -0,0 +1,39 @@
+#ifndef UW_MATRIX_MULTIPLICATION_SPARSEMATGEN_H
+#define UW_MATRIX_MULTIPLICATION_SPARSEMATGEN_H
+
+#include <memory>
+#include <vector>
+#include "matrix.h"
+
+
+// Synthetic sparse matrices A, the counterpart of densematgen. The generator is stateless: the columns of a row
+// depend only on (seed, pattern, row) and the value of an entry only on (seed, row, column), so every process
+// can generate its own block of A without reading or receiving the whole matrix.
+namespace sparsematgen {
+
+enum Patterns {
+    UNIFORM,        // Columns chosen uniformly at random.
+    BANDED,         // Consecutive columns around the diagonal.
+    POWER_LAW,      // R-MAT: numbers of values of rows and columns follow a power law.
+    BLOCK_DIAGONAL, // Random columns within diagonal blocks of 4 * values_per_row rows and columns.
+};
+
+struct Spec {
+    Patterns pattern = UNIFORM;
+    int n = 0;              // Number of rows and columns, 0 if A isn't generated.
+    int values_per_row = 0; // Values of every row (the mean number of values of a row for POWER_LAW).
+    int seed = 1;
+};
+
+// Sorted (distinct) columns of values of the row.
+std::vector<int> RowColumns(const Spec &spec, int row);
+// Value of the entry, one of 0.001, 0.002, ..., 1 (so it is written exactly with a few digits).
+double Value(const Spec &spec, int row, int column);
+
+// Generates the rows [first, last) of the matrix, in the same form as a block of the matrix split by rows
+// (offsets start from the row 0, the rows before 'first' are empty).
+std::unique_ptr<matrix::Sparse> GenerateRows(const Spec &spec, int first, int last);
+
+}
+
+#endif //UW_MATRIX_MULTIPLICATION_SPARSEMATGEN_H
@@ -0,0 +1,51 @@
+#ifndef UW_MATRIX_MULTIPLICATION_TUNER_H
+#define UW_MATRIX_MULTIPLICATION_TUNER_H
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <map>
+#include "matrix.h"
+#include "matrixmul.h"
+#include "communicator.h"
+
+
+namespace tuner {
+
+// Parameters of the network between a pair of processes (alpha and beta of the cost model).
+struct Link {
+    double latency;   // Seconds per message (alpha).
+    double byte_time; // Seconds per byte (beta).
+};
+
+// Parameters of the alpha-beta-gamma cost model. Links are measured for every valid c between the processes
+// which communicate in the plans: partners of shifts of A, and members of replication groups.
+struct Machine {
+    std::map<int, Link> shift;       // Ranks c apart (rings of the "strided" groups of ColA and InnerABC).
+    std::map<int, Link> consecutive; // Groups of c consecutive ranks (A of ColA, B and C of InnerABC).
+    std::map<int, Link> inner;       // Groups replicating A in InnerABC.
+    double flop_time; // Seconds per floating point operation of the local kernel (gamma).
+};
+
+struct Plan {
+    matrixmul::Algorithms algorithm;
+    int c;
+    double cost;   // Predicted time (in seconds).
+    double memory; // Predicted memory (in bytes) used by a single process.
+};
+
+// Measures parameters of the machine: ping-pong between pairs of processes of every communicator used by the plans
+// and the local kernel on a sample of A.
+// The matrix is only needed on the coordinator.
+Machine Calibrate(messaging::Communicator *com, matrix::Sparse *full_matrix);
+
+// Returns predicted costs of every valid (algorithm, c) pair, for a batch of 'batch' matrices B.
+std::vector<Plan> Plans(const Machine &machine, int processes, int n, long values, int exponent, int batch = 1);
+
+// Chooses the cheapest plan fitting in the memory cap (in bytes). The matrix is only needed on the coordinator.
+Plan Tune(messaging::Communicator *com, matrix::Sparse *full_matrix, int exponent, double memory_cap,
+          int batch = 1);
+
+}
+
+#endif //UW_MATRIX_MULTIPLICATION_TUNER_H
@@ -1,7 +1,10 @@
 #include "communicator.h"
+#include "profile.h"
 
 namespace messaging {
 
+constexpr size_t Communicator::MAX_MESSAGE_ITEMS;
+
 Communicator::Communicator(int argc, char **argv) {
     MPI_Init(&argc, &argv);
     _comm = MPI_COMM_WORLD;
@@ -15,7 +18,17 @@ Communicator::Communicator(MPI_Comm base_comm, int base_rank, int divider) {
     MPI_Comm_rank(_comm, &_rank);
 }
 
+Communicator::Communicator(Communicator &&other) noexcept :
+    _comm(other._comm), _rank(other._rank), _num_processes(other._num_processes), _groups(std::move(other._groups)) {
+    other._comm = MPI_COMM_NULL;
+}
+
 Communicator::~Communicator() {
+    // Cached groups have to be freed before MPI is finalized.
+    _groups.clear();
+    if (_comm == MPI_COMM_NULL) {
+        return;
+    }
     if (_comm != MPI_COMM_WORLD) {
         MPI_Comm_free(&_comm);
     } else {
@@ -27,6 +40,14 @@ Communicator Communicator::Split(int divider) {
     return Communicator(_comm, _rank, divider);
 }
 
+Communicator &Communicator::Group(const std::string &name, int divider) {
+    auto &group = _groups[name];
+    if (!group) {
+        group = std::make_unique<Communicator>(_comm, _rank, divider);
+    }
+    return *group;
+}
+
 bool Communicator::isCoordinator() {
     return _rank == Communicator::rankCoordinator();
 }
@@ -43,94 +64,516 @@ int Communicator::numProcesses() {
     return _num_processes;
 }
 
+std::pair<int, int> Communicator::NodeRank() {
+    MPI_Comm node;
+    MPI_Comm_split_type(_comm, MPI_COMM_TYPE_SHARED, _rank, MPI_INFO_NULL, &node);
+    int rank, size;
+    MPI_Comm_rank(node, &rank);
+    MPI_Comm_size(node, &size);
+    MPI_Comm_free(&node);
+    return std::make_pair(rank, size);
+}
+
 void Communicator::BroadcastSendN(int n) {
-    MPI_Bcast(&n, 1, MPI_INT, _rank, _comm);
+    profile::TraceScope trace("BroadcastSendN");
+    broadcast(&n, 1, MPI_INT, _rank);
 }
 
 int Communicator::BroadcastReceiveN() {
+    profile::TraceScope trace("BroadcastReceiveN");
     int n;
-    MPI_Bcast(&n, 1, MPI_INT, rankCoordinator(), _comm);
+    broadcast(&n, 1, MPI_INT, rankCoordinator());
     return n;
 }
 
+void Communicator::BroadcastSendDouble(double value) {
+    profile::TraceScope trace("BroadcastSendDouble");
+    broadcast(&value, 1, MPI_DOUBLE, _rank);
+}
+
+double Communicator::BroadcastReceiveDouble() {
+    profile::TraceScope trace("BroadcastReceiveDouble");
+    double value;
+    broadcast(&value, 1, MPI_DOUBLE, rankCoordinator());
+    return value;
+}
+
+void Communicator::BroadcastSendInts(std::vector<int> &v) {
+    profile::TraceScope trace("BroadcastSendInts");
+    int size = static_cast<int>(v.size());
+    broadcast(&size, 1, MPI_INT, _rank);
+    broadcast(v.data(), size, MPI_INT, _rank);
+}
+
+std::vector<int> Communicator::BroadcastReceiveInts(int root) {
+    profile::TraceScope trace("BroadcastReceiveInts");
+    int size;
+    broadcast(&size, 1, MPI_INT, root);
+    std::vector<int> v(size);
+    broadcast(v.data(), size, MPI_INT, root);
+    return v;
+}
+
+double Communicator::AllReduceMax(double value) {
+    double result;
+    profile::CountMessage(profile::REDUCTION, sizeof(value));
+    MPI_Allreduce(&value, &result, 1, MPI_DOUBLE, MPI_MAX, _comm);
+    return result;
+}
+
+// Returns offsets of consecutive parts of a buffer (MPI takes them as ints, so the buffer must be smaller than 2^31).
+std::vector<int> displacements(std::vector<int> &counts) {
+    long total = 0;
+    for (int count : counts) {
+        total += count;
+    }
+    if (total > std::numeric_limits<int>::max()) {
+        throw std::runtime_error("Exchanged buffers are limited to 2^31-1 values per process.");
+    }
+    std::vector<int> d(counts.size(), 0);
+    for (size_t i = 1; i < counts.size(); i++) {
+        d[i] = d[i - 1] + counts[i - 1];
+    }
+    return d;
+}
+
+void Communicator::Barrier() {
+    MPI_Barrier(_comm);
+}
+
+std::string Communicator::GatherChars(const std::string &text) {
+    int size = static_cast<int>(text.size());
+    std::vector<int> sizes(isCoordinator() ? _num_processes : 0);
+    MPI_Gather(&size, 1, MPI_INT, sizes.data(), 1, MPI_INT, rankCoordinator(), _comm);
+    std::vector<int> offsets = isCoordinator() ? displacements(sizes) : std::vector<int>();
+    std::string result(isCoordinator() ? offsets.back() + sizes.back() : 0, ' ');
+    MPI_Gatherv(text.data(), size, MPI_CHAR, &result[0], sizes.data(), offsets.data(), MPI_CHAR,
+                rankCoordinator(), _comm);
+    return result;
+}
+
+std::vector<double> Communicator::ReduceDoubles(std::vector<double> &values, MPI_Op op) {
+    std::vector<double> result(isCoordinator() ? values.size() : 0);
+    profile::CountMessage(profile::REDUCTION, values.size() * sizeof(double));
+    MPI_Reduce(values.data(), result.data(), static_cast<int>(values.size()), MPI_DOUBLE, op, rankCoordinator(),
+               _comm);
+    return result;
+}
+
+void Communicator::AllReduceSumDoubles(std::vector<double> &values) {
+    profile::TraceScope trace("AllReduceSumDoubles");
+    profile::CountMessage(profile::REDUCTION, values.size() * sizeof(double));
+    MPI_Allreduce(MPI_IN_PLACE, values.data(), static_cast<int>(values.size()), MPI_DOUBLE, MPI_SUM, _comm);
+}
+
+double Communicator::PingPong(int peer, int bytes, int repetitions) {
+    std::vector<char> buffer(bytes);
+    double start = MPI_Wtime();
+    for (int i = 0; i < repetitions; i++) {
+        if (_rank < peer) {
+            MPI_Send(buffer.data(), bytes, MPI_CHAR, peer, 0, _comm);
+            MPI_Recv(buffer.data(), bytes, MPI_CHAR, peer, 0, _comm, MPI_STATUS_IGNORE);
+        } else {
+            MPI_Recv(buffer.data(), bytes, MPI_CHAR, peer, 0, _comm, MPI_STATUS_IGNORE);
+            MPI_Send(buffer.data(), bytes, MPI_CHAR, peer, 0, _comm);
+        }
+    }
+    return (MPI_Wtime() - start) / (2 * repetitions);
+}
+
 void Communicator::SendN(long n, int receiver, int phase) {
-    MPI_Send(&n, 1, MPI_LONG, receiver, phase, _comm);
+    profile::TraceScope trace("SendN");
+    send(&n, 1, MPI_LONG, receiver, phase);
 }
 
 long Communicator::ReceiveN(int sender, int phase) {
+    profile::TraceScope trace("ReceiveN");
     long n;
-    MPI_Recv(&n, 1, MPI_LONG, sender, phase, _comm, MPI_STATUS_IGNORE);
+    receive(&n, 1, MPI_LONG, sender, phase);
     return n;
 }
 
+void combine_statistics(void *in, void *inout, int *length, MPI_Datatype *) {
+    auto from = static_cast<matrix::Statistics *>(in);
+    auto to = static_cast<matrix::Statistics *>(inout);
+    for (int i = 0; i < *length; i++) {
+        to[i].Combine(from[i]);
+    }
+}
+
+std::vector<matrix::Statistics> Communicator::ReduceStatistics(std::vector<matrix::Statistics> &statistics) {
+    int lengths[7] = {1, 1, 1, 1, 1, 1, matrix::MAX_HISTOGRAM_BINS};
+    MPI_Aint offsets[7] = {offsetof(matrix::Statistics, ge_count), offsetof(matrix::Statistics, count),
+                           offsetof(matrix::Statistics, min), offsetof(matrix::Statistics, max),
+                           offsetof(matrix::Statistics, sum), offsetof(matrix::Statistics, sum_squares),
+                           offsetof(matrix::Statistics, histogram)};
+    MPI_Datatype types[7] = {MPI_LONG, MPI_LONG, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_LONG};
+    MPI_Datatype packed, datatype;
+    MPI_Type_create_struct(7, lengths, offsets, types, &packed);
+    MPI_Type_create_resized(packed, 0, sizeof(matrix::Statistics), &datatype);
+    MPI_Type_commit(&datatype);
+    MPI_Op op;
+    MPI_Op_create(combine_statistics, 1, &op);
+
+    std::vector<matrix::Statistics> result(isCoordinator() ? statistics.size() : 0);
+    profile::CountMessage(profile::REDUCTION, statistics.size() * sizeof(matrix::Statistics));
+    MPI_Reduce(statistics.data(), result.data(), static_cast<int>(statistics.size()), datatype, op,
+               rankCoordinator(), _comm);
+
+    MPI_Op_free(&op);
+    MPI_Type_free(&datatype);
+    MPI_Type_free(&packed);
+    return result;
+}
+
+void Communicator::WriteDenseFile(const std::string &path, matrix::Dense *m, const std::vector<int> &row_order) {
+    MPI_File file;
+    if (MPI_File_open(_comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        throw std::runtime_error("Couldn't open " + path + " for writing.");
+    }
+    MPI_File_set_size(file, 0);
+    std::int64_t header[3] = {m->n_original, m->n_original, m->batch};
+    if (isCoordinator()) {
+        MPI_File_write_at(file, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+    }
+
+    // Only the original rows and columns are written, rows of the block are sorted by their rows in the file
+    // (displacements of a file view must not decrease).
+    int columns = std::max(0, std::min(m->columns, m->n_original - m->column_base));
+    std::vector<std::pair<int, int>> rows; // (row in the file, row of the block)
+    for (int y = 0; y < m->rows && columns > 0; y++) {
+        int row = m->row_base + y;
+        if (row < m->n_original) {
+            rows.emplace_back(row < static_cast<int>(row_order.size()) ? row_order[row] : row, y);
+        }
+    }
+    std::sort(rows.begin(), rows.end());
+    std::vector<MPI_Aint> displacements;
+    for (const auto &row : rows) {
+        displacements.push_back((static_cast<MPI_Aint>(row.first) * m->n_original + m->column_base) *
+                                static_cast<MPI_Aint>(sizeof(double)));
+    }
+    MPI_Datatype file_type;
+    MPI_Type_create_hindexed_block(static_cast<int>(rows.size()), columns, displacements.data(), MPI_DOUBLE,
+                                   &file_type);
+    MPI_Type_commit(&file_type);
+
+    // Rows are written as single items, so that the count fits in an int.
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(columns, MPI_DOUBLE, &row_type);
+    MPI_Type_commit(&row_type);
+
+    // Matrices of the batch are written one by one, so only a single matrix is packed at a time.
+    std::vector<double> buffer(rows.size() * columns);
+    MPI_Offset matrix_bytes = static_cast<MPI_Offset>(m->n_original) * m->n_original * sizeof(double);
+    for (int s = 0; s < m->batch; s++) {
+        for (int p = 0; p < m->Panels(); p++) {
+            int width = m->panels[p + 1] - m->panels[p];
+            int panel_columns = std::max(0, std::min(width, m->column_base + columns - m->panels[p]));
+            for (size_t i = 0; i < rows.size(); i++) {
+                auto from = m->values.begin() + m->PanelOffset(p) +
+                            (static_cast<size_t>(rows[i].second) * m->batch + s) * width;
+                std::copy(from, from + panel_columns, buffer.begin() + i * columns + m->panels[p] - m->column_base);
+            }
+        }
+        MPI_File_set_view(file, sizeof(header) + s * matrix_bytes, MPI_DOUBLE, file_type, "native", MPI_INFO_NULL);
+        MPI_File_write_all(file, buffer.data(), static_cast<int>(rows.size()), row_type, MPI_STATUS_IGNORE);
+    }
+    MPI_File_set_size(file, sizeof(header) + m->batch * matrix_bytes);
+    MPI_Type_free(&row_type);
+    MPI_Type_free(&file_type);
+    MPI_File_close(&file);
+}
+
 void Communicator::SendDense(matrix::Dense *m, int receiver, int phase) {
-    int meta[6] = {m->rows, m->column_base, m->columns, m->columns_total, static_cast<int>(m->values.size()), m->n_original};
-    MPI_Send(&meta[0], 6, MPI_INT, receiver, phase, _comm);
-    MPI_Send(m->values.data(), m->values.size(), MPI_DOUBLE, receiver, phase, _comm);
+    profile::TraceScope trace("SendDense");
+    std::int64_t meta[DENSE_META] = {m->rows, m->column_base, m->columns, m->columns_total,
+                                     static_cast<std::int64_t>(m->values.size()), m->n_original, m->row_base,
+                                     m->batch, m->Panels()};
+    send(&meta[0], DENSE_META, MPI_INT64_T, receiver, phase);
+    send(m->values.data(), m->values.size(), MPI_DOUBLE, receiver, phase);
+    // Boundaries of a single panel follow from the meta information.
+    if (m->Panels() > 1) {
+        send(m->panels.data(), m->panels.size(), MPI_INT, receiver, phase);
+    }
 }
 
 std::unique_ptr<matrix::Dense> Communicator::ReceiveDense(int sender, int phase) {
-    int meta[6];
-    MPI_Recv(&meta[0], 6, MPI_INT, sender, phase, _comm, MPI_STATUS_IGNORE);
-    std::vector<double> values(meta[4]);
-    MPI_Recv(values.data(), values.size(), MPI_DOUBLE, sender, phase, _comm, MPI_STATUS_IGNORE);
-    return std::make_unique<matrix::Dense>(meta[0], meta[5], meta[1], meta[2], meta[3], std::move(values));
+    profile::TraceScope trace("ReceiveDense");
+    std::int64_t meta[DENSE_META];
+    receive(&meta[0], DENSE_META, MPI_INT64_T, sender, phase);
+    matrix::Buffer<double> values(meta[4]);
+    receive(values.data(), values.size(), MPI_DOUBLE, sender, phase);
+    auto m = denseFromMeta(meta, std::move(values));
+    if (m->Panels() > 1) {
+        receive(m->panels.data(), m->panels.size(), MPI_INT, sender, phase);
+    }
+    return m;
 }
 
 void Communicator::BroadcastSendDense(matrix::Dense *m) {
-    int meta[6] = {m->rows, m->column_base, m->columns, m->columns_total, static_cast<int>(m->values.size()), m->n_original};
-    MPI_Bcast(&meta[0], 6, MPI_INT, _rank, _comm);
-    MPI_Bcast(m->values.data(), m->values.size(), MPI_DOUBLE, _rank, _comm);
+    profile::TraceScope trace("BroadcastSendDense");
+    std::int64_t meta[DENSE_META] = {m->rows, m->column_base, m->columns, m->columns_total,
+                                     static_cast<std::int64_t>(m->values.size()), m->n_original, m->row_base,
+                                     m->batch, m->Panels()};
+    broadcast(&meta[0], DENSE_META, MPI_INT64_T, _rank);
+    broadcast(m->values.data(), m->values.size(), MPI_DOUBLE, _rank);
+    if (m->Panels() > 1) {
+        broadcast(m->panels.data(), m->panels.size(), MPI_INT, _rank);
+    }
 }
 
 std::unique_ptr<matrix::Dense> Communicator::BroadcastReceiveDense(int root) {
-    int meta[6];
-    MPI_Bcast(&meta[0], 6, MPI_INT, root, _comm);
-    std::vector<double> values(meta[4]);
-    MPI_Bcast(values.data(), values.size(), MPI_DOUBLE, root, _comm);
-    return std::make_unique<matrix::Dense>(meta[0], meta[5], meta[1], meta[2], meta[3], std::move(values));
+    profile::TraceScope trace("BroadcastReceiveDense");
+    std::int64_t meta[DENSE_META];
+    broadcast(&meta[0], DENSE_META, MPI_INT64_T, root);
+    matrix::Buffer<double> values(meta[4]);
+    broadcast(values.data(), values.size(), MPI_DOUBLE, root);
+    auto m = denseFromMeta(meta, std::move(values));
+    if (m->Panels() > 1) {
+        broadcast(m->panels.data(), m->panels.size(), MPI_INT, root);
+    }
+    return m;
+}
+
+void Communicator::AllReduceSumDense(matrix::Dense *m) {
+    profile::TraceScope trace("AllReduceSumDense");
+    for (size_t first = 0; first < m->values.size(); first += MAX_MESSAGE_ITEMS) {
+        int count = static_cast<int>(std::min(m->values.size() - first, MAX_MESSAGE_ITEMS));
+        profile::CountMessage(profile::REDUCTION, count * sizeof(double));
+        MPI_Allreduce(MPI_IN_PLACE, m->values.data() + first, count, MPI_DOUBLE, MPI_SUM, _comm);
+    }
+}
+
+std::unique_ptr<matrix::Dense> Communicator::ReduceScatterSumDense(matrix::Dense *m) {
+    profile::TraceScope trace("ReduceScatterSumDense");
+    assert(m->Panels() == _num_processes);
+    std::vector<size_t> sizes(_num_processes);
+    for (int i = 0; i < _num_processes; i++) {
+        sizes[i] = m->PanelOffset(i + 1) - m->PanelOffset(i);
+    }
+    matrix::Buffer<double> values(sizes[_rank]);
+    // Panels larger than MAX_MESSAGE_ITEMS are reduced in a few rounds, each of them covering the same range
+    // of items of every panel (packed into a buffer, unless a single round covers whole panels).
+    size_t largest = *std::max_element(sizes.begin(), sizes.end());
+    std::vector<int> counts(_num_processes);
+    std::vector<double> buffer;
+    for (size_t first = 0; first == 0 || first < largest; first += MAX_MESSAGE_ITEMS) {
+        for (int i = 0; i < _num_processes; i++) {
+            counts[i] = static_cast<int>(std::min(sizes[i] - std::min(sizes[i], first), MAX_MESSAGE_ITEMS));
+        }
+        const double *send = m->values.data();
+        if (largest > MAX_MESSAGE_ITEMS) {
+            buffer.clear();
+            for (int i = 0; i < _num_processes; i++) {
+                auto from = m->values.begin() + m->PanelOffset(i) + std::min(sizes[i], first);
+                buffer.insert(buffer.end(), from, from + counts[i]);
+            }
+            send = buffer.data();
+        }
+        countMessage(profile::REDUCTION, std::accumulate(counts.begin(), counts.end(), 0L), MPI_DOUBLE);
+        MPI_Reduce_scatter(send, values.data() + std::min(sizes[_rank], first), counts.data(), MPI_DOUBLE, MPI_SUM,
+                           _comm);
+    }
+    auto part = std::make_unique<matrix::Dense>(m->rows, m->n_original, m->panels[_rank],
+                                                m->panels[_rank + 1] - m->panels[_rank], m->columns_total,
+                                                std::move(values));
+    part->row_base = m->row_base;
+    part->batch = m->batch;
+    return part;
+}
+
+std::vector<int> Communicator::AllToAllCounts(std::vector<int> &send_counts) {
+    std::vector<int> receive_counts(_num_processes);
+    countAllToAll(std::vector<int>(_num_processes, 1), MPI_INT);
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1, MPI_INT, _comm);
+    return receive_counts;
+}
+
+std::vector<int> Communicator::AllToAllInts(std::vector<int> &send, std::vector<int> &send_counts,
+                                            std::vector<int> &receive_counts) {
+    profile::TraceScope trace("AllToAllInts");
+    auto send_displacements = displacements(send_counts);
+    auto receive_displacements = displacements(receive_counts);
+    std::vector<int> receive(receive_displacements.back() + receive_counts.back());
+    countAllToAll(send_counts, MPI_INT);
+    MPI_Alltoallv(send.data(), send_counts.data(), send_displacements.data(), MPI_INT,
+                  receive.data(), receive_counts.data(), receive_displacements.data(), MPI_INT, _comm);
+    return receive;
+}
+
+matrix::Buffer<double> Communicator::AllToAllDoubles(std::vector<double> &send, std::vector<int> &send_counts,
+                                                     std::vector<int> &receive_counts) {
+    profile::TraceScope trace("AllToAllDoubles");
+    auto send_displacements = displacements(send_counts);
+    auto receive_displacements = displacements(receive_counts);
+    matrix::Buffer<double> receive(receive_displacements.back() + receive_counts.back());
+    countAllToAll(send_counts, MPI_DOUBLE);
+    MPI_Alltoallv(send.data(), send_counts.data(), send_displacements.data(), MPI_DOUBLE,
+                  receive.data(), receive_counts.data(), receive_displacements.data(), MPI_DOUBLE, _comm);
+    return receive;
+}
+
+void Communicator::ShiftSparse(std::unique_ptr<matrix::Sparse> &m, std::unique_ptr<matrix::Sparse> &buffer,
+                               int sender, int receiver, int phase) {
+    profile::TraceScope trace("ShiftSparse");
+    matrix::index_t meta[4] = {matrix::ToIndex(m->values.size()), matrix::ToIndex(m->rows_number_of_values.size()),
+                               m->n, m->row_base};
+    matrix::index_t received[4];
+    sendReceive(&meta[0], 4, &received[0], 4, MPI_INDEX_T, sender, receiver, phase);
+    buffer->n = static_cast<int>(received[2]);
+    buffer->row_base = static_cast<int>(received[3]);
+    buffer->values.resize(received[0]);
+    buffer->values_column.resize(received[0]);
+    buffer->rows_number_of_values.resize(received[1]);
+    sendReceive(m->values.data(), meta[0], buffer->values.data(), received[0], MPI_DOUBLE, sender, receiver,
+                phase);
+    sendReceive(m->values_column.data(), meta[0], buffer->values_column.data(), received[0], MPI_INT, sender,
+                receiver, phase);
+    sendReceive(m->rows_number_of_values.data(), meta[1], buffer->rows_number_of_values.data(), received[1],
+                MPI_INDEX_T, sender, receiver, phase);
+    std::swap(m, buffer);
 }
 
 void Communicator::SendSparse(matrix::Sparse *m, int receiver, int phase) {
-    int meta[3] = {static_cast<int>(m->values.size()), static_cast<int>(m->rows_number_of_values.size()), m->n};
-    MPI_Send(&meta[0], 3, MPI_INT, receiver, phase, _comm);
-    MPI_Send(m->values.data(), m->values.size(), MPI_DOUBLE, receiver, phase, _comm);
-    MPI_Send(m->values_column.data(), m->values_column.size(), MPI_INT, receiver, phase, _comm);
-    MPI_Send(m->rows_number_of_values.data(), m->rows_number_of_values.size(), MPI_INT, receiver, phase, _comm);
+    profile::TraceScope trace("SendSparse");
+    matrix::index_t meta[4] = {matrix::ToIndex(m->values.size()), matrix::ToIndex(m->rows_number_of_values.size()),
+                               m->n, m->row_base};
+    send(&meta[0], 4, MPI_INDEX_T, receiver, phase);
+    send(m->values.data(), m->values.size(), MPI_DOUBLE, receiver, phase);
+    send(m->values_column.data(), m->values_column.size(), MPI_INT, receiver, phase);
+    send(m->rows_number_of_values.data(), m->rows_number_of_values.size(), MPI_INDEX_T, receiver, phase);
 }
 
 std::unique_ptr<matrix::Sparse> Communicator::ReceiveSparse(int sender, int phase) {
-    int meta[3];
-    MPI_Recv(&meta[0], 3, MPI_INT, sender, phase, _comm, MPI_STATUS_IGNORE);
-    std::vector<double> values(meta[0]);
-    std::vector<int> values_column(meta[0]);
-    std::vector<int> rows_number_of_values(meta[1]);
-    MPI_Recv(values.data(), meta[0], MPI_DOUBLE, sender, phase, _comm, MPI_STATUS_IGNORE);
-    MPI_Recv(values_column.data(), meta[0], MPI_INT, sender, phase, _comm, MPI_STATUS_IGNORE);
-    MPI_Recv(rows_number_of_values.data(), meta[1], MPI_INT, sender, phase, _comm, MPI_STATUS_IGNORE);
-    return std::make_unique<matrix::Sparse>(meta[2], std::move(values), std::move(rows_number_of_values),
-        std::move(values_column));
+    profile::TraceScope trace("ReceiveSparse");
+    matrix::index_t meta[4];
+    receive(&meta[0], 4, MPI_INDEX_T, sender, phase);
+    matrix::Buffer<double> values(meta[0]);
+    matrix::Buffer<int> values_column(meta[0]);
+    matrix::Buffer<matrix::index_t> rows_number_of_values(meta[1]);
+    receive(values.data(), meta[0], MPI_DOUBLE, sender, phase);
+    receive(values_column.data(), meta[0], MPI_INT, sender, phase);
+    receive(rows_number_of_values.data(), meta[1], MPI_INDEX_T, sender, phase);
+    auto m = std::make_unique<matrix::Sparse>(static_cast<int>(meta[2]), std::move(values),
+                                              std::move(rows_number_of_values), std::move(values_column));
+    m->row_base = static_cast<int>(meta[3]);
+    return m;
 }
 
 void Communicator::BroadcastSendSparse(matrix::Sparse *m) {
-    int meta[3] = {static_cast<int>(m->values.size()), static_cast<int>(m->rows_number_of_values.size()), m->n};
-    MPI_Bcast(&meta[0], 3, MPI_INT, _rank, _comm);
-    MPI_Bcast(m->values.data(), m->values.size(), MPI_DOUBLE, _rank, _comm);
-    MPI_Bcast(m->values_column.data(), m->values_column.size(), MPI_INT, _rank, _comm);
-    MPI_Bcast(m->rows_number_of_values.data(), m->rows_number_of_values.size(), MPI_INT, _rank, _comm);
+    profile::TraceScope trace("BroadcastSendSparse");
+    matrix::index_t meta[4] = {matrix::ToIndex(m->values.size()), matrix::ToIndex(m->rows_number_of_values.size()),
+                               m->n, m->row_base};
+    broadcast(&meta[0], 4, MPI_INDEX_T, _rank);
+    broadcast(m->values.data(), m->values.size(), MPI_DOUBLE, _rank);
+    broadcast(m->values_column.data(), m->values_column.size(), MPI_INT, _rank);
+    broadcast(m->rows_number_of_values.data(), m->rows_number_of_values.size(), MPI_INDEX_T, _rank);
 }
 
 std::unique_ptr<matrix::Sparse> Communicator::BroadcastReceiveSparse(int root) {
-    int meta[3];
-    MPI_Bcast(&meta[0], 3, MPI_INT, root, _comm);
-    std::vector<double> values(meta[0]);
-    std::vector<int> values_column(meta[0]);
-    std::vector<int> rows_number_of_values(meta[1]);
-    MPI_Bcast(values.data(), meta[0], MPI_DOUBLE, root, _comm);
-    MPI_Bcast(values_column.data(), meta[0], MPI_INT, root, _comm);
-    MPI_Bcast(rows_number_of_values.data(), meta[1], MPI_INT, root, _comm);
-    return std::make_unique<matrix::Sparse>(meta[2], std::move(values), std::move(rows_number_of_values),
-                                            std::move(values_column));
+    profile::TraceScope trace("BroadcastReceiveSparse");
+    matrix::index_t meta[4];
+    broadcast(&meta[0], 4, MPI_INDEX_T, root);
+    matrix::Buffer<double> values(meta[0]);
+    matrix::Buffer<int> values_column(meta[0]);
+    matrix::Buffer<matrix::index_t> rows_number_of_values(meta[1]);
+    broadcast(values.data(), meta[0], MPI_DOUBLE, root);
+    broadcast(values_column.data(), meta[0], MPI_INT, root);
+    broadcast(rows_number_of_values.data(), meta[1], MPI_INDEX_T, root);
+    auto m = std::make_unique<matrix::Sparse>(static_cast<int>(meta[2]), std::move(values),
+                                              std::move(rows_number_of_values), std::move(values_column));
+    m->row_base = static_cast<int>(meta[3]);
+    return m;
+}
+
+void Communicator::countMessage(profile::Traffic kind, size_t count, MPI_Datatype type) {
+    int size;
+    MPI_Type_size(type, &size);
+    profile::CountMessage(kind, count * size);
+}
+
+void Communicator::countAllToAll(const std::vector<int> &send_counts, MPI_Datatype type) {
+    // Only non-empty parts sent to the other processes are counted.
+    for (int i = 0; i < _num_processes; i++) {
+        if (i != _rank && send_counts[i] > 0) {
+            countMessage(profile::ALL_TO_ALL, send_counts[i], type);
+        }
+    }
+}
+
+// Buffers larger than MAX_MESSAGE_ITEMS are transferred as a few messages (counts of MPI calls are ints).
+
+// Returns the address of the item 'index' of a buffer of a given type.
+const char *item(const void *data, size_t index, MPI_Datatype type) {
+    int size;
+    MPI_Type_size(type, &size);
+    return static_cast<const char *>(data) + index * size;
+}
+
+char *item(void *data, size_t index, MPI_Datatype type) {
+    return const_cast<char *>(item(static_cast<const void *>(data), index, type));
+}
+
+void Communicator::send(const void *data, size_t count, MPI_Datatype type, int receiver, int phase) {
+    for (size_t first = 0; first == 0 || first < count; first += MAX_MESSAGE_ITEMS) {
+        int items = static_cast<int>(std::min(count - first, MAX_MESSAGE_ITEMS));
+        countMessage(profile::POINT_TO_POINT, items, type);
+        MPI_Send(item(data, first, type), items, type, receiver, phase, _comm);
+    }
+}
+
+void Communicator::receive(void *data, size_t count, MPI_Datatype type, int sender, int phase) {
+    for (size_t first = 0; first == 0 || first < count; first += MAX_MESSAGE_ITEMS) {
+        int items = static_cast<int>(std::min(count - first, MAX_MESSAGE_ITEMS));
+        MPI_Recv(item(data, first, type), items, type, sender, phase, _comm, MPI_STATUS_IGNORE);
+    }
+}
+
+void Communicator::broadcast(void *data, size_t count, MPI_Datatype type, int root) {
+    for (size_t first = 0; first == 0 || first < count; first += MAX_MESSAGE_ITEMS) {
+        int items = static_cast<int>(std::min(count - first, MAX_MESSAGE_ITEMS));
+        if (_rank == root) {
+            countMessage(profile::BROADCAST, items, type);
+        }
+        MPI_Bcast(item(data, first, type), items, type, root, _comm);
+    }
+}
+
+void Communicator::sendReceive(const void *send_data, size_t send_count, void *receive_data, size_t receive_count,
+                               MPI_Datatype type, int sender, int receiver, int phase) {
+    if (send_count <= MAX_MESSAGE_ITEMS && receive_count <= MAX_MESSAGE_ITEMS) {
+        countMessage(profile::POINT_TO_POINT, send_count, type);
+        MPI_Sendrecv(send_data, static_cast<int>(send_count), type, receiver, phase,
+                     receive_data, static_cast<int>(receive_count), type, sender, phase, _comm, MPI_STATUS_IGNORE);
+        return;
+    }
+    // Numbers of messages sent and received differ, so they can't be paired in MPI_Sendrecv.
+    std::vector<MPI_Request> requests;
+    for (size_t first = 0; first == 0 || first < receive_count; first += MAX_MESSAGE_ITEMS) {
+        requests.emplace_back();
+        int items = static_cast<int>(std::min(receive_count - first, MAX_MESSAGE_ITEMS));
+        MPI_Irecv(item(receive_data, first, type), items, type, sender, phase, _comm, &requests.back());
+    }
+    for (size_t first = 0; first == 0 || first < send_count; first += MAX_MESSAGE_ITEMS) {
+        requests.emplace_back();
+        int items = static_cast<int>(std::min(send_count - first, MAX_MESSAGE_ITEMS));
+        countMessage(profile::POINT_TO_POINT, items, type);
+        MPI_Isend(item(send_data, first, type), items, type, receiver, phase, _comm, &requests.back());
+    }
+    MPI_Waitall(static_cast<int>(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+}
+
+std::unique_ptr<matrix::Dense> Communicator::denseFromMeta(const std::int64_t *meta,
+                                                          matrix::Buffer<double> &&values) {
+    auto m = std::make_unique<matrix::Dense>(static_cast<int>(meta[0]), static_cast<int>(meta[5]),
+                                             static_cast<int>(meta[1]), static_cast<int>(meta[2]),
+                                             static_cast<int>(meta[3]), std::move(values));
+    m->row_base = static_cast<int>(meta[6]);
+    m->batch = static_cast<int>(meta[7]);
+    // Boundaries of the panels (other than the only one) are received separately.
+    m->panels.resize(meta[8] + 1, m->column_base + m->columns);
+    return m;
 }
 
 }
@@ -1,46 +1,293 @@
 #include <memory>
+#include <sys/resource.h>
 #include "parser.h"
 #include "matrix.h"
 #include "communicator.h"
+#include "tuner.h"
+#include "numa.h"
+#include "profile.h"
+#include "sparsematgen.h"
 
 
+// Job-server mode: the coordinator reads the next valid job and broadcasts it to the other processes.
+// Returns false when there are no more jobs.
+bool next_job(messaging::Communicator *communicator, std::istream *jobs, parser::Job &job) {
+    std::vector<int> message;
+    if (communicator->isCoordinator()) {
+        std::string line;
+        while (std::getline(*jobs, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            if (!parser::parse_job(line, job)) {
+                std::cerr << "Invalid job (expected \"seeds exponent [-g ge_value | -v]\"): " << line << std::endl;
+                continue;
+            }
+            message = {job.exponent, job.print_the_matrix_c};
+            message.insert(message.end(), job.seeds.begin(), job.seeds.end());
+            break;
+        }
+        communicator->BroadcastSendInts(message);
+        if (!message.empty()) {
+            communicator->BroadcastSendDouble(job.ge_value);
+        }
+    } else {
+        message = communicator->BroadcastReceiveInts(communicator->rankCoordinator());
+        if (!message.empty()) {
+            job.exponent = message[0];
+            job.print_the_matrix_c = message[1] != 0;
+            job.seeds.assign(message.begin() + 2, message.end());
+            job.ge_value = communicator->BroadcastReceiveDouble();
+        }
+    }
+    return !message.empty();
+}
+
+// Prints the requested statistics of the result (on the coordinator): the count of values >= g (alone in a line,
+// if g > 0), then the other statistics and bins of the histogram ("bin low high count"), one per line.
+void print_statistics(const matrix::Statistics &st, double g, const std::vector<std::string> &names,
+                      const matrix::HistogramRange &histogram) {
+    if (g > 0) {
+        std::cout << st.ge_count << std::endl;
+    }
+    for (const auto &name : names) {
+        double value = 0;
+        if (name == "min") {
+            value = st.min;
+        } else if (name == "max") {
+            value = st.max;
+        } else if (name == "sum") {
+            value = st.sum;
+        } else if (name == "mean") {
+            value = st.count > 0 ? st.sum / st.count : 0;
+        } else if (name == "norm") {
+            value = std::sqrt(st.sum_squares);
+        }
+        std::cout << name << " " << value << std::endl;
+    }
+    double width = histogram.bins > 0 ? (histogram.high - histogram.low) / histogram.bins : 0;
+    for (int i = 0; i < histogram.bins; i++) {
+        std::cout << "bin " << histogram.low + i * width << " " << histogram.low + (i + 1) * width << " "
+                  << st.histogram[i] << std::endl;
+    }
+}
+
+// Relative error above which a verified result is reported as wrong.
+const double VERIFY_TOLERANCE = 1e-9;
+
+// Checks the results of the job (see Algorithm::phaseVerify) and reports the error of every result.
+void verify(messaging::Communicator *communicator, matrixmul::Algorithm *algorithm, const parser::Job &job) {
+    double start = MPI_Wtime();
+    auto errors = algorithm->phaseVerify(job.seeds, job.exponent);
+    if (communicator->isCoordinator()) {
+        double max_error = *std::max_element(errors.begin(), errors.end());
+        std::cerr << "Verification: max relative error " << max_error << " in " << MPI_Wtime() - start << "s";
+        for (size_t s = 0; s < errors.size(); s++) {
+            if (errors[s] > VERIFY_TOLERANCE) {
+                std::cerr << ", FAILED for seed " << job.seeds[s] << " (" << errors[s] << ")";
+            }
+        }
+        std::cerr << std::endl;
+    }
+}
+
+// Events kept by every process in the trace (the oldest ones are overwritten).
+const size_t TRACE_EVENTS = 1 << 18;
+
+// Reports the peak resident memory (the largest one of all processes and the one of the coordinator), buffers of
+// matrices and the cores every process runs on.
+void report_memory(messaging::Communicator *communicator) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double peak = usage.ru_maxrss / 1024.0; // Kilobytes on Linux.
+    double max_peak = communicator->AllReduceMax(peak);
+    const auto &buffers = numa::Stats();
+    double buffers_peak = communicator->AllReduceMax(buffers.peak_bytes / (1024.0 * 1024.0));
+    double buffers_count = communicator->AllReduceMax(buffers.count);
+    double huge = communicator->AllReduceMax(buffers.huge_bytes / (1024.0 * 1024.0));
+    double fallbacks = communicator->AllReduceMax(buffers.huge_fallbacks);
+    auto cores = communicator->GatherChars("  process " + std::to_string(communicator->rank()) + ": " +
+                                           numa::DescribeAffinity() + "\n");
+    if (communicator->isCoordinator()) {
+        std::cerr << "Peak resident memory: " << max_peak << " MB (max of processes), " << peak
+                  << " MB (coordinator)" << std::endl;
+        std::cerr << "Buffers of matrices: peak " << buffers_peak << " MB, " << buffers_count
+                  << " allocations, " << huge << " MB with huge pages (max of processes)";
+        if (fallbacks > 0) {
+            std::cerr << ", " << fallbacks << " fell back from hugetlb to transparent huge pages";
+        }
+        std::cerr << std::endl << "Affinity:" << std::endl << cores;
+    }
+}
+
 int main(int argc, char **argv) {
     // Initialize communication between processes.
     auto communicator = messaging::Communicator(argc, argv);
     // Parse command line arguments.
     auto arg = parser::Arguments(argc, argv);
-    // Parse provided sparse Matrix from plaintext file.
+    // Processes are pinned before any matrix is allocated, so that every buffer is first touched (and placed)
+    // on the NUMA node of the process using it.
+    if (arg.affinity != numa::NO_AFFINITY) {
+        auto node = communicator.NodeRank();
+        numa::Pin(arg.affinity, node.first, node.second);
+    }
+    numa::SetHugePages(arg.huge_pages);
+    if (!arg.trace_file.empty()) {
+        profile::StartTrace(&communicator, TRACE_EVENTS);
+    }
+    // Parse provided sparse Matrix from plaintext file (a generated one is never held as a whole, unless dumped).
     std::unique_ptr<matrix::Sparse> matrix_sparse;
     if (communicator.isCoordinator()) {
-        matrix_sparse = parser::parse_sparse_matrix(arg.sparse_matrix_file);
+        if (arg.generator.n == 0) {
+            matrix_sparse = parser::parse_sparse_matrix(arg.sparse_matrix_file);
+        } else if (!arg.dump_file.empty()) {
+            parser::write_sparse_matrix(arg.dump_file, *sparsematgen::GenerateRows(arg.generator, 0, arg.generator.n));
+        }
+    }
+
+    // A single run is a single job given by the arguments. In the job-server mode A is distributed and
+    // replicated once, and then reused by all of the jobs read by the coordinator.
+    parser::Job job;
+    job.seeds = arg.seeds;
+    job.exponent = arg.exponent;
+    job.ge_value = arg.ge_value;
+    job.print_the_matrix_c = arg.print_the_matrix_c;
+    bool serve = !arg.jobs_file.empty();
+    std::ifstream jobs_file;
+    std::istream *jobs = &std::cin;
+    if (serve) {
+        if (communicator.isCoordinator() && arg.jobs_file != "-") {
+            jobs_file.open(arg.jobs_file);
+            if (!jobs_file.is_open()) {
+                throw std::runtime_error("Couldn't open the jobs file.");
+            }
+            jobs = &jobs_file;
+        }
+        if (!next_job(&communicator, jobs, job)) {
+            return 0;
+        }
+    }
+
+    // Choose the algorithm and the replication group size based on the calibrated cost model.
+    if (arg.auto_tune) {
+        auto plan = tuner::Tune(&communicator, matrix_sparse.get(), job.exponent, arg.memory_cap,
+                                static_cast<int>(job.seeds.size()));
+        arg.algorithm = plan.algorithm;
+        arg.replication_group_size = plan.c;
     }
 
+    matrixmul::Options options;
+    options.balanced = arg.balanced;
+    options.reordering = arg.reordering;
+    options.symmetry = arg.symmetry;
+    options.memory_budget = arg.memory_budget;
+    options.generator = arg.generator;
+    options.power_iteration = arg.power_iteration;
+    options.tolerance = arg.tolerance;
+
     // 1. Initialize algorithm and data (with distribution).
     std::unique_ptr<matrixmul::Algorithm> algorithm;
+    auto distribution = std::make_unique<profile::Scope>(profile::DISTRIBUTION);
     switch (arg.algorithm) {
         case matrixmul::Algorithms::COLA:
             algorithm = std::make_unique<matrixmul::AlgorithmCOLA>(std::move(matrix_sparse), &communicator,
-                arg.replication_group_size, arg.seed);
+                arg.replication_group_size, job.seeds, options);
             break;
         case matrixmul::Algorithms::COLABC:
             algorithm = std::make_unique<matrixmul::AlgorithmInnerABC>(std::move(matrix_sparse), &communicator,
-                arg.replication_group_size, arg.seed);
+                arg.replication_group_size, job.seeds, options);
+            break;
+        case matrixmul::Algorithms::COLB:
+            algorithm = std::make_unique<matrixmul::AlgorithmCOLB>(std::move(matrix_sparse), &communicator,
+                arg.replication_group_size, job.seeds, options);
+            break;
+        case matrixmul::Algorithms::SUMMA:
+            algorithm = std::make_unique<matrixmul::AlgorithmSUMMA>(std::move(matrix_sparse), &communicator,
+                arg.replication_group_size, job.seeds, options);
+            break;
+        case matrixmul::Algorithms::SPARSE1D:
+            algorithm = std::make_unique<matrixmul::AlgorithmSparse1D>(std::move(matrix_sparse), &communicator,
+                arg.replication_group_size, job.seeds, options);
             break;
     }
 
+    distribution.reset();
+
     // 2. After this initial data distribution, processes should contact their peers in replication groups and
     // exchange their parts of matrices.
-    algorithm->phaseReplication();
+    {
+        profile::Scope scope(profile::REPLICATION);
+        algorithm->phaseReplication();
+    }
 
-    // 3. Computation.
-    algorithm->phaseComputation(arg.exponent);
+    for (int job_number = 1; ; job_number++) {
+        double start = MPI_Wtime();
+        if (job_number > 1) {
+            // Only B is generated (and replicated) again, A stays distributed and replicated.
+            profile::Scope scope(profile::REPLICATION);
+            algorithm->phaseNextJob(job.seeds);
+        }
+        // 3. Computation.
+        {
+            profile::Scope scope(profile::COMPUTATION);
+            algorithm->phaseComputation(job.exponent);
+        }
+        if (arg.verify) {
+            verify(&communicator, algorithm.get(), job);
+        }
+        if (arg.power_iteration && job.exponent > 0 && communicator.isCoordinator()) {
+            std::cerr << "Power iteration: " << algorithm->iterations << " of " << job.exponent
+                      << " multiplications, residual " << algorithm->residual
+                      << (algorithm->residual < arg.tolerance ? " (converged)" : "") << std::endl;
+        }
+        auto final = std::make_unique<profile::Scope>(profile::FINAL);
 
-    // 4. Final phase of gathering results from the workers.
-    if (arg.ge_value > 0) {
-        algorithm->phaseFinalGE(arg.ge_value);
-    } else if (arg.print_the_matrix_c) {
-        algorithm->phaseFinalMatrix();
+        // 4. Final phase: the results are written into the output file (without gathering them), and then
+        // gathered from the workers (separately for every seed, in the given order).
+        if (!arg.output_file.empty()) {
+            algorithm->phaseFinalFile(arg.output_file);
+        }
+        // Statistics of the whole batch are reduced at once, without gathering C.
+        if (job.ge_value > 0 || !arg.statistics.empty() || arg.histogram.bins > 0) {
+            auto statistics = algorithm->phaseFinalStatistics(job.ge_value, arg.histogram);
+            for (const auto &st : statistics) {
+                print_statistics(st, job.ge_value, arg.statistics, arg.histogram);
+            }
+        } else if (job.print_the_matrix_c) {
+            for (size_t s = 0; s < job.seeds.size(); s++) {
+                algorithm->selectResult(static_cast<int>(s));
+                algorithm->phaseFinalMatrix();
+            }
+        }
+        final.reset();
+
+        if (!serve) {
+            break;
+        }
+        if (communicator.isCoordinator()) {
+            std::cout.flush();
+            std::cerr << "Job " << job_number << " done in " << MPI_Wtime() - start << "s" << std::endl;
+        }
+        if (!next_job(&communicator, jobs, job)) {
+            break;
+        }
     }
 
+    if (arg.report_memory) {
+        report_memory(&communicator);
+    }
+    if (!arg.trace_file.empty()) {
+        profile::WriteTrace(&communicator, arg.trace_file);
+    }
+    if (!arg.profile_file.empty()) {
+        std::ofstream file;
+        if (communicator.isCoordinator() && arg.profile_file != "-") {
+            file.open(arg.profile_file);
+            if (!file.is_open()) {
+                throw std::runtime_error("Couldn't open the profile file.");
+            }
+        }
+        profile::Report(&communicator, arg.profile_file != "-" ? static_cast<std::ostream &>(file) : std::cerr);
+    }
     return 0;
 }
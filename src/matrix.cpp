@@ -2,6 +2,14 @@
 
 namespace matrix {
 
+index_t ToIndex(size_t items) {
+    if (items > static_cast<size_t>(std::numeric_limits<index_t>::max())) {
+        throw std::runtime_error("Sparse matrix has more values than fit in its index type, configure with "
+                                 "-DMATRIXMUL_INDEX64=ON.");
+    }
+    return static_cast<index_t>(items);
+}
+
 int block_column_size(int width, int blocks) {
     int columns = (width / blocks);
     if (width % blocks != 0) {
@@ -10,79 +18,189 @@ int block_column_size(int width, int blocks) {
     return columns;
 }
 
-int block_column_base(int width, int *block_width, int part) {
-    int column_base = (*block_width) * part;
-    if (column_base + (*block_width) >= width) {
-        *block_width = width - column_base;
+std::pair<int, int> block_column_range(int width, int part, int parts_total) {
+    int block_width = block_column_size(width, parts_total);
+    int column_base = std::min(block_width * part, width);
+    return std::make_pair(column_base, std::min(column_base + block_width, width));
+}
+
+Partition PartitionUniform(int width, int parts) {
+    Partition partition;
+    for (int i = 0; i < parts; i++) {
+        partition.push_back(block_column_range(width, i, parts).first);
     }
-    return column_base;
+    partition.push_back(width);
+    return partition;
 }
 
-Dense::Dense(int n, int n_original, int part, int parts_total, int seed) : n_original{n_original}, rows{n},
-    columns_total{n} {
-    columns = block_column_size(n, parts_total);
-    column_base = block_column_base(n, &columns, part);
-    for (int r = 0; r < n; r++) {
-        for (int c = 0; c < columns; c++) {
-            if (c >= n_original)
-                values.push_back(0);
-            else
-                values.push_back(generate_double(seed, r, column_base + c));
+Partition PartitionBalanced(const std::vector<long> &weights, int parts) {
+    int width = static_cast<int>(weights.size());
+    // prefix[i] is the total weight of the range [0, i).
+    std::vector<long> prefix(weights.size() + 1, 0);
+    for (size_t i = 0; i < weights.size(); i++) {
+        prefix[i + 1] = prefix[i] + weights[i];
+    }
+    long total = prefix.back();
+    if (total == 0) {
+        return PartitionUniform(width, parts);
+    }
+
+    Partition partition;
+    partition.push_back(0);
+    for (int i = 1; i < parts; i++) {
+        // Pick the boundary which makes the prefix closest to the ideal share.
+        double target = static_cast<double>(total) * i / parts;
+        auto it = std::lower_bound(prefix.begin(), prefix.end(), static_cast<long>(std::ceil(target)));
+        int boundary = static_cast<int>(it - prefix.begin());
+        if (boundary > 0 && target - prefix[boundary - 1] < prefix[std::min(boundary, width)] - target) {
+            boundary--;
         }
+        boundary = std::min(std::max(boundary, partition.back()), width);
+        partition.push_back(boundary);
     }
+    partition.push_back(width);
+    return partition;
 }
 
-Dense::Dense(int n, int n_original, int part, int parts_total) : n_original{n_original}, rows{n}, columns_total{n} {
-    columns = block_column_size(n, parts_total);
-    column_base = block_column_base(n, &columns, part);
-    if (columns < 0) {
-        columns = 0;
-        column_base = n;
-        return;
+double PartitionImbalance(const std::vector<long> &weights, const Partition &partition) {
+    int parts = static_cast<int>(partition.size()) - 1;
+    long total = 0;
+    long heaviest = 0;
+    for (int i = 0; i < parts; i++) {
+        long part_weight = 0;
+        for (int j = partition[i]; j < partition[i + 1]; j++) {
+            part_weight += weights[j];
+        }
+        total += part_weight;
+        heaviest = std::max(heaviest, part_weight);
+    }
+    if (total == 0) {
+        return 1;
     }
-    size_t s = columns * n;
-    assert(s < values.max_size());
-    values.resize(columns * n);
+    return static_cast<double>(heaviest) * parts / total;
 }
 
-Dense::Dense(int n, int n_original, int column_base, int columns, int columns_total, std::vector<double> &&values) :
+int PartitionOwner(const Partition &partition, int index) {
+    return static_cast<int>(std::upper_bound(partition.begin(), partition.end(), index) - partition.begin()) - 1;
+}
+
+Dense::Dense(int n, int n_original, int part, int parts_total, int seed) :
+    Dense(n, n_original, block_column_range(n, part, parts_total), std::vector<int>{seed}) {}
+
+Dense::Dense(int n, int n_original, int part, int parts_total) :
+    Dense(n, n_original, block_column_range(n, part, parts_total)) {}
+
+Dense::Dense(int n, int n_original, int column_base, int columns, int columns_total, Buffer<double> &&values) :
     n_original{n_original}, rows{n}, column_base{column_base}, columns{columns}, columns_total{columns_total},
-    values{values} {}
+    panels{column_base, column_base + columns}, values{std::move(values)} {}
 
 Dense::Dense(int n, int n_original, std::pair<int, int> column_range) : n_original{n_original}, rows{n}, columns_total{n} {
     column_base = column_range.first;
     columns = column_range.second - column_range.first;
-    int size = columns * rows;
-    if (size < 0) {
-        size = 0;
+    panels = {column_base, column_base + columns};
+    values.resize(columns > 0 ? static_cast<size_t>(columns) * rows : 0);
+}
+
+Dense::Dense(int n, int n_original, std::pair<int, int> column_range, const std::vector<int> &seeds) :
+    n_original{n_original}, rows{n}, columns_total{n}, batch{static_cast<int>(seeds.size())} {
+    column_base = column_range.first;
+    columns = column_range.second - column_range.first;
+    panels = {column_base, column_base + columns};
+    values.reserve(static_cast<size_t>(rows) * columns * batch);
+    for (int r = 0; r < n; r++) {
+        for (int seed : seeds) {
+            for (int c = column_base; c < column_base + columns; c++) {
+                if (c >= n_original)
+                    values.push_back(0);
+                else
+                    values.push_back(generate_double(seed, r, c));
+            }
+        }
     }
-    values.resize(size);
+}
+
+Dense::Dense(int n, int n_original, std::pair<int, int> row_range, std::pair<int, int> column_range, int batch) :
+    n_original{n_original}, rows{row_range.second - row_range.first}, row_base{row_range.first},
+    column_base{column_range.first}, columns{column_range.second - column_range.first}, columns_total{n},
+    batch{batch}, panels{column_range.first, column_range.second} {
+    values.resize(static_cast<size_t>(rows) * columns * batch);
+}
+
+std::unique_ptr<Dense> Dense::ZerosLike() const {
+    auto m = std::make_unique<Dense>(columns_total, n_original, std::make_pair(row_base, row_base + rows),
+                                     std::make_pair(column_base, column_base + columns), batch);
+    m->panels = panels;
+    return m;
+}
+
+std::unique_ptr<Dense> Dense::Panel(int panel) const {
+    Buffer<double> panel_values(values.begin() + PanelOffset(panel), values.begin() + PanelOffset(panel + 1));
+    auto m = std::make_unique<Dense>(rows, n_original, panels[panel], panels[panel + 1] - panels[panel],
+                                     columns_total, std::move(panel_values));
+    m->row_base = row_base;
+    m->batch = batch;
+    return m;
 }
 
 std::pair<int, int> Dense::ColumnRange() {
     return std::make_pair(column_base, column_base + columns);
 }
 
-size_t Dense::valuesIndex(int x, int y) {
-    int ry = y * columns;
-    int rx = x - column_base;
-    assert(ry + rx >= 0);
-    assert(ry + rx < static_cast<int>(values.size()));
-    return ry + rx;
+std::pair<int, int> Dense::RowRange() {
+    return std::make_pair(row_base, row_base + rows);
 }
 
-double Dense::Get(int x, int y) {
-    return values[valuesIndex(x, y)];
+size_t Dense::valuesIndex(int x, int y, int batch_index) {
+    assert(row_base <= y && y < row_base + rows && column_base <= x && x < column_base + columns);
+    int panel = Panels() == 1 ? 0 : PartitionOwner(panels, x);
+    int width = panels[panel + 1] - panels[panel];
+    size_t ry = (static_cast<size_t>(y - row_base) * batch + batch_index) * width;
+    size_t rx = x - panels[panel];
+    assert(PanelOffset(panel) + ry + rx < values.size());
+    return PanelOffset(panel) + ry + rx;
 }
 
-void Dense::Set(int x, int y, double value) {
-    values[valuesIndex(x, y)] = value;
+double Dense::Get(int x, int y, int batch_index) {
+    return values[valuesIndex(x, y, batch_index)];
+}
+
+void Dense::Set(int x, int y, double value, int batch_index) {
+    values[valuesIndex(x, y, batch_index)] = value;
 }
 
 void Dense::ItemAdd(int x, int y, double value) {
     Set(x, y, Get(x, y) + value);
 }
 
+std::unique_ptr<Dense> Dense::Extract(int batch_index) {
+    auto m = std::make_unique<Dense>(columns_total, n_original, RowRange(), ColumnRange());
+    m->panels = panels;
+    for (int p = 0; p < Panels(); p++) {
+        int width = panels[p + 1] - panels[p];
+        auto from_panel = values.begin() + PanelOffset(p);
+        auto to_panel = m->values.begin() + m->PanelOffset(p);
+        for (int r = 0; r < rows; r++) {
+            auto from = from_panel + (static_cast<size_t>(r) * batch + batch_index) * width;
+            std::copy(from, from + width, to_panel + static_cast<size_t>(r) * width);
+        }
+    }
+    return m;
+}
+
+void Dense::PermuteRows(const std::vector<int> &permutation) {
+    Buffer<double> permuted(values.size());
+    for (int p = 0; p < Panels(); p++) {
+        size_t width = static_cast<size_t>(panels[p + 1] - panels[p]) * batch;
+        auto from_panel = values.begin() + PanelOffset(p);
+        auto to_panel = permuted.begin() + PanelOffset(p);
+        for (int r = 0; r < rows; r++) {
+            size_t from = r < static_cast<int>(permutation.size()) ? permutation[r] : r;
+            std::copy(from_panel + from * width, from_panel + (from + 1) * width, to_panel + r * width);
+        }
+    }
+    values = std::move(permuted);
+}
+
 std::unique_ptr<Dense> MergeSame(Denses &&ds) {
     if (ds.empty()) {
         return nullptr;
@@ -94,18 +212,23 @@ std::unique_ptr<Dense> MergeSame(Denses &&ds) {
     int n = ds[0]->rows;
     int column_base = ds[0]->column_base;
     int columns = ds[0]->columns;
+    int batch = ds[0]->batch;
     for (size_t i = 0; i < ds.size() - 1; i++) {
         assert(ds[i+1]->column_base == ds[i]->column_base);
         assert(ds[i+1]->columns == ds[i]->columns);
+        assert(ds[i+1]->batch == batch);
+        assert(ds[i+1]->panels == ds[i]->panels);
     }
-    size_t values_size = columns * n;
-    std::vector<double> values;
+    // Copies have the same layout, so their values are merged position by position.
+    int width = columns * batch;
+    size_t values_size = static_cast<size_t>(width) * n;
+    Buffer<double> values;
     assert(values_size < values.max_size());
     values.resize(values_size);
 
     for (int r = 0; r < n; r++) {
-        size_t it = (r * columns);
-        for (int j = 0; j < columns; j++) {
+        size_t it = static_cast<size_t>(r) * width;
+        for (int j = 0; j < width; j++) {
             for (const auto &m : ds) {
                 if (m->values[it + j] == 0)
                     continue;
@@ -114,7 +237,10 @@ std::unique_ptr<Dense> MergeSame(Denses &&ds) {
         }
     }
 
-    return std::make_unique<Dense>(n, ds[0]->n_original, column_base, columns, n, std::move(values));
+    auto m = std::make_unique<Dense>(n, ds[0]->n_original, column_base, columns, n, std::move(values));
+    m->batch = batch;
+    m->panels = ds[0]->panels;
+    return m;
 }
 
 std::unique_ptr<Dense> Merge(Denses &&ds) {
@@ -125,7 +251,8 @@ std::unique_ptr<Dense> Merge(Denses &&ds) {
         return std::move(ds[0]);
     }
 
-    if (ds[0]->column_base == ds[1]->column_base) {
+    // Empty blocks (of processes without any columns) are not copies of each other.
+    if (ds[0]->columns > 0 && ds[0]->column_base == ds[1]->column_base) {
         return MergeSame(std::move(ds));
     }
 
@@ -142,75 +269,148 @@ std::unique_ptr<Dense> Merge(Denses &&ds) {
         assert(ds[i+1]->column_base == ds[i]->column_base + ds[i]->columns);
     }
     int columns = 0;
+    int batch = ds[0]->batch;
     for (const auto &m : ds) {
+        assert(m->batch == batch);
         if (m->columns < 0) {
             continue;
         }
         columns += m->columns;
     }
-    size_t values_size = columns * n;
-    // Copy item values.
-    std::vector<double> values;
+    size_t values_size = static_cast<size_t>(columns) * n * batch;
+    // Blocks become panels of the merged block, so their values are concatenated.
+    Buffer<double> values;
     assert(values_size < values.max_size());
-    values.resize(values_size);
-
-    int i = 0;
-    for (int r = 0; r < n; r++) {
-        for (const auto &m : ds) {
-            size_t base = (r * m->columns);
-            for (int j = 0; j < m->columns; j++) {
-                values[i++] = m->values[base + j];
-            }
-        }
+    values.reserve(values_size);
+    Partition panels = {column_base};
+    // Empty blocks are kept as empty panels, so that the panel 'i' is always the block 'i'.
+    for (const auto &m : ds) {
+        values.insert(values.end(), m->values.begin(), m->values.end());
+        panels.insert(panels.end(), m->panels.begin() + 1, m->panels.end());
     }
 
     // Create unique pointer to the newly created Matrix.
-    return std::make_unique<Dense>(n, ds[0]->n_original, column_base, columns, n, std::move(values));
+    auto m = std::make_unique<Dense>(n, ds[0]->n_original, column_base, columns, n, std::move(values));
+    m->batch = batch;
+    m->panels = std::move(panels);
+    return m;
 }
 
-std::ostream &operator<<(std::ostream &os, const Dense &m) {
-    std::cout.precision(5);
-    int i = 0;
-    for (int r = 0; r < m.n_original; r++) {
+// Appends the rows [first, last) of the matrix as text: values (as printed by an ostream with the precision 5)
+// followed by tabs, columns held by the other processes are printed as zeroes.
+void format_rows(const Dense &m, int first, int last, std::string &text) {
+    char number[32];
+    for (int r = first; r < last; r++) {
+        int panel = 0;
         for (int c = 0; c < m.columns_total; c++) {
             if (m.column_base <= c && c < m.column_base + m.columns) {
                 if (c >= m.n_original) {
-                    i++;
                     continue;
                 }
-                os << m.values[i++];
+                while (c >= m.panels[panel + 1]) {
+                    panel++;
+                }
+                int width = m.panels[panel + 1] - m.panels[panel];
+                int length = snprintf(number, sizeof(number), "%.5g",
+                                      m.values[m.PanelOffset(panel) + static_cast<size_t>(r) * width + c -
+                                               m.panels[panel]]);
+                text.append(number, length);
             } else {
-                os << "0.000";
+                text.append("0.000");
             }
-            os << "\t";
+            text.push_back('\t');
         }
-        os << std::endl;
+        text.push_back('\n');
     }
+}
+
+std::ostream &operator<<(std::ostream &os, const Dense &m) {
+    assert(m.batch == 1);
+    std::string text;
+    format_rows(m, 0, m.n_original, text);
+    os.write(text.data(), text.size());
     return os;
 }
 
-Sparse::Sparse(int n, std::vector<double> &&values, std::vector<int> &&rows_number_of_values,
-               std::vector<int> &&values_column) : n{n}, values{values},
-                                                    rows_number_of_values{rows_number_of_values},
-                                                    values_column{values_column} {}
+void Print(const Dense &m, FILE *file) {
+    assert(m.batch == 1);
+    // Blocks of about 1 MB of text, at most one block per thread is formatted ahead of the written one.
+    const size_t BLOCK_BYTES = 1 << 20;
+    int rows_per_block = std::max<int>(1, BLOCK_BYTES / (8 * std::max(m.columns_total, 1)));
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    auto format = [&m](int first, int last) {
+        std::string text;
+        format_rows(m, first, last, text);
+        return text;
+    };
+    std::deque<std::future<std::string>> blocks;
+    int next = 0;
+    while (next < m.n_original || !blocks.empty()) {
+        while (next < m.n_original && blocks.size() < threads) {
+            int last = std::min(next + rows_per_block, m.n_original);
+            blocks.push_back(std::async(threads > 1 ? std::launch::async : std::launch::deferred, format, next, last));
+            next = last;
+        }
+        auto text = blocks.front().get();
+        blocks.pop_front();
+        fwrite(text.data(), 1, text.size(), file);
+    }
+}
+
+Sparse::Sparse(int n, Buffer<double> &&values, Buffer<index_t> &&rows_number_of_values, Buffer<int> &&values_column) :
+    n{n}, values{std::move(values)}, rows_number_of_values{std::move(rows_number_of_values)},
+    values_column{std::move(values_column)} {}
+
+Sparse::Sparse(int n, const std::vector<int> &coordinates, const Buffer<double> &values) : n{n} {
+    // Sort values by (row, column).
+    std::vector<size_t> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&coordinates](size_t a, size_t b) {
+        return std::make_pair(coordinates[2 * a], coordinates[2 * a + 1]) <
+               std::make_pair(coordinates[2 * b], coordinates[2 * b + 1]);
+    });
+    ToIndex(values.size());
+    this->values.reserve(values.size());
+    values_column.reserve(values.size());
+    rows_number_of_values.assign(n + 1, 0);
+    for (size_t i : order) {
+        this->values.push_back(values[i]);
+        values_column.push_back(coordinates[2 * i + 1]);
+        rows_number_of_values[coordinates[2 * i] + 1]++;
+    }
+    for (int r = 0; r < n; r++) {
+        rows_number_of_values[r + 1] += rows_number_of_values[r];
+    }
+}
 
 std::vector<Sparse> Sparse::Split(int processes, bool split_by_column) {
-    std::vector<std::vector<double>> m_values(processes);
-    std::vector<int> m_last_row(processes);
-    std::vector<std::vector<int>> m_rows_values(processes);
-    std::vector<std::vector<int>> m_value_column(processes);
+    return Split(PartitionUniform(n, processes), split_by_column);
+}
 
-    int block_width = block_column_size(n, processes);
-    int it = 0;
+std::vector<Sparse> Sparse::Split(const Partition &partition, bool split_by_column) {
+    int processes = static_cast<int>(partition.size()) - 1;
+    std::vector<Buffer<double>> m_values(processes);
+    std::vector<int> m_last_row(processes);
+    std::vector<Buffer<index_t>> m_rows_values(processes);
+    std::vector<Buffer<int>> m_value_column(processes);
+
+    // Determine the owner of every row / column.
+    std::vector<int> owner(n);
+    for (int part = 0; part < processes; part++) {
+        for (int i = partition[part]; i < partition[part + 1]; i++) {
+            owner[i] = part;
+        }
+    }
+    index_t it = 0;
     for (int row = 0; row < n; row++) {
-        int values_in_row = rows_number_of_values[row + 1] - rows_number_of_values[row];
-        for (int i = 0; i < values_in_row; i++) {
+        index_t values_in_row = rows_number_of_values[row + 1] - rows_number_of_values[row];
+        for (index_t i = 0; i < values_in_row; i++) {
             int column = values_column[it];
             int part;
             if (split_by_column) {
-                part = column / block_width;
+                part = owner[column];
             } else {
-                part = row / block_width;
+                part = owner[row];
             }
             if (m_rows_values[part].empty()) {
                 m_rows_values[part].push_back(0);
@@ -231,15 +431,31 @@ std::vector<Sparse> Sparse::Split(int processes, bool split_by_column) {
     for (int i = 0; i < processes; i++) {
         m_rows_values[i].push_back(m_values[i].size());
         auto m = Sparse(n, std::move(m_values[i]), std::move(m_rows_values[i]), std::move(m_value_column[i]));
-        matrices.push_back(m);
+        matrices.push_back(std::move(m));
     }
     return matrices;
 }
 
+std::vector<long> Sparse::ValuesPerRow() {
+    std::vector<long> counts(n, 0);
+    for (int row = 0; row + 1 < static_cast<int>(rows_number_of_values.size()); row++) {
+        counts[row] = rows_number_of_values[row + 1] - rows_number_of_values[row];
+    }
+    return counts;
+}
+
+std::vector<long> Sparse::ValuesPerColumn() {
+    std::vector<long> counts(n, 0);
+    for (int column : values_column) {
+        counts[column]++;
+    }
+    return counts;
+}
+
 std::ostream &operator<<(std::ostream &os, const Sparse &m) {
-    int n = 0;
+    index_t n = 0;
     for (int r = 0; r < m.n; r++) {
-        int values_in_row = m.rows_number_of_values[r+1] - m.rows_number_of_values[r];
+        index_t values_in_row = m.rows_number_of_values[r+1] - m.rows_number_of_values[r];
         for (int i = 0; i < m.n; i++) {
             if (values_in_row > 0 && i == m.values_column[n]) {
                 os << m.values[n++];
@@ -254,6 +470,289 @@ std::ostream &operator<<(std::ostream &os, const Sparse &m) {
     return os;
 }
 
+void RowEpochs::Next(int rows) {
+    if (static_cast<int>(epoch.size()) != rows) {
+        epoch.assign(rows, current);
+    }
+    current++;
+}
+
+// Adds (or writes, if 'overwrite') av * (row 'x' of b) to the row 'y' of c, panel by panel.
+// Rows of every matrix in the batch are next to each other, so they are multiplied as a single wider row.
+inline void add_row(const Dense *b, Dense *c, int y, int x, double av, bool overwrite) {
+    for (int p = 0; p < c->Panels(); p++) {
+        int columns = (c->panels[p + 1] - c->panels[p]) * c->batch;
+        double *c_row = c->values.data() + c->PanelOffset(p) + static_cast<size_t>(y - c->row_base) * columns;
+        const double *b_row = b->values.data() + b->PanelOffset(p) + static_cast<size_t>(x - b->row_base) * columns;
+        if (overwrite) {
+            for (int i = 0; i < columns; i++) {
+                c_row[i] = av * b_row[i];
+            }
+        } else {
+            for (int i = 0; i < columns; i++) {
+                c_row[i] += av * b_row[i];
+            }
+        }
+    }
+}
+
+void MultiplyAdd(Sparse *a, Dense *b, Dense *c, RowEpochs *epochs) {
+    assert(b->panels == c->panels && b->batch == c->batch);
+    assert(epochs == nullptr || static_cast<int>(epochs->epoch.size()) == c->rows);
+    int rows = static_cast<int>(a->rows_number_of_values.size()) - 1;
+    if (c->Panels() > 1) {
+        for (int r = 0; r < rows; r++) {
+            int ay = a->row_base + r;
+            index_t i = a->rows_number_of_values[r];
+            if (i < a->rows_number_of_values[r + 1] && epochs != nullptr && epochs->First(ay - c->row_base)) {
+                add_row(b, c, ay, a->values_column[i], a->values[i], true);
+                i++;
+            }
+            for (; i < a->rows_number_of_values[r + 1]; i++) {
+                add_row(b, c, ay, a->values_column[i], a->values[i], false);
+            }
+        }
+        return;
+    }
+    // A single panel: the loops of add_row, with the row of c kept for all of the values of the row of a.
+    int columns = b->columns * b->batch;
+    for (int r = 0; r < rows; r++) {
+        index_t i = a->rows_number_of_values[r];
+        if (i == a->rows_number_of_values[r + 1]) {
+            continue;
+        }
+        int ay = a->row_base + r;
+        assert(c->row_base <= ay && ay < c->row_base + c->rows);
+        double *c_row = c->values.data() + static_cast<size_t>(ay - c->row_base) * columns;
+        if (epochs != nullptr && epochs->First(ay - c->row_base)) {
+            double av = a->values[i];
+            const double *b_row = b->values.data() + static_cast<size_t>(a->values_column[i] - b->row_base) * columns;
+            for (int x = 0; x < columns; x++) {
+                c_row[x] = av * b_row[x];
+            }
+            i++;
+        }
+        for (; i < a->rows_number_of_values[r + 1]; i++) {
+            double av = a->values[i];
+            const double *b_row = b->values.data() + static_cast<size_t>(a->values_column[i] - b->row_base) * columns;
+            for (int x = 0; x < columns; x++) {
+                c_row[x] += av * b_row[x];
+            }
+        }
+    }
+}
+
+void MultiplyAddSymmetric(Sparse *a, Dense *b, Dense *c, RowEpochs *epochs) {
+    assert(b->panels == c->panels && b->batch == c->batch);
+    // Adds av * (row 'x' of b) to the row 'y' of c (or overwrites it, if it is its first contribution).
+    auto add = [b, c, epochs](int y, int x, double av) {
+        assert(c->row_base <= y && y < c->row_base + c->rows);
+        add_row(b, c, y, x, av, epochs != nullptr && epochs->First(y - c->row_base));
+    };
+    int rows = static_cast<int>(a->rows_number_of_values.size()) - 1;
+    for (int r = 0; r < rows; r++) {
+        int ay = a->row_base + r;
+        for (index_t i = a->rows_number_of_values[r]; i < a->rows_number_of_values[r + 1]; i++) {
+            int ax = a->values_column[i];
+            add(ay, ax, a->values[i]);
+            if (ax != ay) {
+                add(ax, ay, a->values[i]);
+            }
+        }
+    }
+}
+
+bool IsSymmetric(Sparse *m) {
+    std::vector<std::tuple<int, int, double>> values, transposed;
+    auto it = SparseIt(m);
+    while (it.Next()) {
+        auto v = it.Value();
+        values.push_back(v);
+        transposed.emplace_back(std::get<1>(v), std::get<0>(v), std::get<2>(v));
+    }
+    std::sort(values.begin(), values.end());
+    std::sort(transposed.begin(), transposed.end());
+    return values == transposed;
+}
+
+std::unique_ptr<Sparse> UpperTriangle(Sparse *m) {
+    Buffer<double> values;
+    Buffer<index_t> rows_number_of_values = {0};
+    Buffer<int> values_column;
+    int rows = static_cast<int>(m->rows_number_of_values.size()) - 1;
+    for (int r = 0; r < rows; r++) {
+        for (index_t i = m->rows_number_of_values[r]; i < m->rows_number_of_values[r + 1]; i++) {
+            if (m->values_column[i] >= r + m->row_base) {
+                values.push_back(m->values[i]);
+                values_column.push_back(m->values_column[i]);
+            }
+        }
+        rows_number_of_values.push_back(static_cast<index_t>(values.size()));
+    }
+    auto upper = std::make_unique<Sparse>(m->n, std::move(values), std::move(rows_number_of_values),
+                                          std::move(values_column));
+    upper->row_base = m->row_base;
+    return upper;
+}
+
+void ZeroStaleRows(Dense *c, const RowEpochs &epochs) {
+    for (int p = 0; p < c->Panels(); p++) {
+        int columns = (c->panels[p + 1] - c->panels[p]) * c->batch;
+        for (int y = 0; y < c->rows; y++) {
+            if (epochs.epoch[y] != epochs.current) {
+                auto row = c->values.begin() + c->PanelOffset(p) + static_cast<size_t>(y) * columns;
+                std::fill(row, row + columns, 0);
+            }
+        }
+    }
+}
+
+void Statistics::Combine(const Statistics &other) {
+    ge_count += other.ge_count;
+    count += other.count;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    sum += other.sum;
+    sum_squares += other.sum_squares;
+    for (int i = 0; i < MAX_HISTOGRAM_BINS; i++) {
+        histogram[i] += other.histogram[i];
+    }
+}
+
+// Index of the bin of the histogram containing the value, -1 if it is out of its range.
+int histogram_bin(double value, const HistogramRange &histogram) {
+    if (histogram.bins <= 0 || value < histogram.low || value >= histogram.high) {
+        return -1;
+    }
+    int bin = static_cast<int>((value - histogram.low) / (histogram.high - histogram.low) * histogram.bins);
+    return std::min(bin, histogram.bins - 1);
+}
+
+void Statistics::AddZeros(long zeros, double g, const HistogramRange &histogram) {
+    if (zeros <= 0) {
+        return;
+    }
+    ge_count += 0 >= g ? zeros : 0;
+    count += zeros;
+    min = std::min(min, 0.0);
+    max = std::max(max, 0.0);
+    int bin = histogram_bin(0, histogram);
+    if (bin >= 0) {
+        this->histogram[bin] += zeros;
+    }
+}
+
+std::vector<Statistics> BatchStatistics(Dense *m, double g, const HistogramRange &histogram) {
+    std::vector<Statistics> statistics(m->batch);
+    int rows = std::min(m->rows, m->n_original - m->row_base);
+    for (int p = 0; p < m->Panels(); p++) {
+        int width = m->panels[p + 1] - m->panels[p];
+        int columns = std::max(0, std::min(width, m->n_original - m->panels[p]));
+        const double *panel = m->values.data() + m->PanelOffset(p);
+        for (int y = 0; y < rows; y++) {
+            for (int s = 0; s < m->batch; s++) {
+                auto &st = statistics[s];
+                const double *row = panel + (static_cast<size_t>(y) * m->batch + s) * width;
+                for (int x = 0; x < columns; x++) {
+                    double value = row[x];
+                    if (value == 0) {
+                        continue;
+                    }
+                    st.ge_count += value >= g;
+                    st.count++;
+                    st.min = std::min(st.min, value);
+                    st.max = std::max(st.max, value);
+                    st.sum += value;
+                    st.sum_squares += value * value;
+                    int bin = histogram_bin(value, histogram);
+                    if (bin >= 0) {
+                        st.histogram[bin]++;
+                    }
+                }
+            }
+        }
+    }
+    return statistics;
+}
+
+void AddColumnMoments(Dense *b, Dense *c, const std::vector<double> &shifts, std::vector<double> &moments) {
+    assert(b->rows == c->rows && b->row_base == c->row_base && b->panels == c->panels && b->batch == c->batch);
+    int rows = std::min(c->rows, c->n_original - c->row_base);
+    for (int p = 0; p < c->Panels(); p++) {
+        int width = c->panels[p + 1] - c->panels[p];
+        int columns = std::max(0, std::min(width, c->n_original - c->panels[p]));
+        const double *panel_b = b->values.data() + b->PanelOffset(p);
+        const double *panel_c = c->values.data() + c->PanelOffset(p);
+        for (int y = 0; y < rows; y++) {
+            for (int s = 0; s < c->batch; s++) {
+                size_t offset = (static_cast<size_t>(y) * c->batch + s) * width;
+                for (int x = 0; x < columns; x++) {
+                    size_t column = static_cast<size_t>(c->panels[p] + x) * c->batch + s;
+                    double vb = panel_b[offset + x];
+                    double vc = panel_c[offset + x];
+                    double r = vc - shifts[column] * vb;
+                    double *m = moments.data() + MOMENTS * column;
+                    m[C_C] += vc * vc;
+                    m[C_B] += vc * vb;
+                    m[B_B] += vb * vb;
+                    m[RESIDUAL] += r * r;
+                }
+            }
+        }
+    }
+}
+
+void ScaleColumns(Dense *m, const std::vector<double> &scales) {
+    for (int p = 0; p < m->Panels(); p++) {
+        int width = m->panels[p + 1] - m->panels[p];
+        double *panel = m->values.data() + m->PanelOffset(p);
+        for (int y = 0; y < m->rows; y++) {
+            for (int s = 0; s < m->batch; s++) {
+                double *row = panel + (static_cast<size_t>(y) * m->batch + s) * width;
+                for (int x = 0; x < width; x++) {
+                    row[x] *= scales[static_cast<size_t>(m->panels[p] + x) * m->batch + s];
+                }
+            }
+        }
+    }
+}
+
+void MultiplyAddVector(Dense *m, const std::vector<double> &x, double *y) {
+    for (int p = 0; p < m->Panels(); p++) {
+        int width = m->panels[p + 1] - m->panels[p];
+        const double *panel = m->values.data() + m->PanelOffset(p);
+        const double *panel_x = x.data() + m->panels[p];
+        for (int r = 0; r < m->rows; r++) {
+            for (int s = 0; s < m->batch; s++) {
+                const double *row = panel + (static_cast<size_t>(r) * m->batch + s) * width;
+                double sum = 0;
+                for (int i = 0; i < width; i++) {
+                    sum += row[i] * panel_x[i];
+                }
+                y[static_cast<size_t>(m->row_base + r) * m->batch + s] += sum;
+            }
+        }
+    }
+}
+
+double MultiplyTime(Sparse *m, int columns) {
+    auto range = std::make_pair(0, columns);
+    auto b = Dense(m->n, m->n, std::make_pair(0, m->n), range);
+    auto c = Dense(m->n, m->n, std::make_pair(0, m->n), range);
+    std::fill(b.values.begin(), b.values.end(), 1);
+    // Best of a few runs, so that the first touch of the memory is not measured.
+    double best = 0;
+    for (int i = 0; i < 3; i++) {
+        auto start = std::chrono::steady_clock::now();
+        MultiplyAdd(m, &b, &c);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
 // sitCmp compares SparseIt iterators.
 // It returns True if value of the first one is before the second one.
 // Firstly compares X and Y. It also checks if iterator is EOF (value==0).
@@ -276,6 +775,7 @@ Sparse::Sparse(Sparse *a, Sparse *b) {
     // Initialize values for the new Sparse matrix.
     n = a->n;
     size_t items = a->values.size() + b->values.size();
+    ToIndex(items);
     assert(items < values.max_size());
     values.resize(items);
     rows_number_of_values.push_back(0);
@@ -321,7 +821,7 @@ Sparse::Sparse(Sparse *a, Sparse *b) {
 SparseIt::SparseIt(matrix::Sparse *m) : _m{m} {}
 
 std::tuple<int,int,double> SparseIt::Value() {
-    if (i >= static_cast<int>(_m->values.size())) {
+    if (i >= static_cast<index_t>(_m->values.size())) {
         return std::make_tuple(-1, -1, 0);
     }
     return std::make_tuple(r, _m->values_column[i], _m->values[i]);
@@ -329,7 +829,7 @@ std::tuple<int,int,double> SparseIt::Value() {
 
 bool SparseIt::Next() {
     i++;
-    if (i >= static_cast<int>(_m->values.size())) {
+    if (i >= static_cast<index_t>(_m->values.size())) {
         return false;
     }
     if (--_values_in_row <= 0) {
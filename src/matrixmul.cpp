@@ -11,110 +11,395 @@ std::pair<int, int> group_divider(int rank, int replication_group_size, int proc
     return std::make_pair(first_group_id, second_group_id);
 }
 
+// Merges blocks of B or C (recorded in the trace).
+std::unique_ptr<matrix::Dense> merge(matrix::Denses &&ds) {
+    profile::TraceScope trace("merge");
+    return matrix::Merge(std::move(ds));
+}
+
+// Returns the number of items sent to a single process in an all-to-all exchange (counts of MPI_Alltoallv are
+// ints and these exchanges aren't split into a few messages).
+int all_to_all_count(size_t items) {
+    if (items > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        throw std::runtime_error("All-to-all exchanges are limited to 2^31-1 values per pair of processes "
+                                 "(use more processes or fewer seeds).");
+    }
+    return static_cast<int>(items);
+}
+
+// Concatenates parts of a buffer, saving their sizes in 'counts'.
+template <typename T>
+std::vector<T> flatten(std::vector<std::vector<T>> &parts, std::vector<int> &counts) {
+    std::vector<T> buffer;
+    counts.clear();
+    for (auto &part : parts) {
+        counts.push_back(all_to_all_count(part.size()));
+        buffer.insert(buffer.end(), part.begin(), part.end());
+    }
+    return buffer;
+}
+
+matrix::Partition partition_sparse(matrix::Sparse *m, int processes, bool split_by_columns, const Options &options) {
+    auto uniform = matrix::PartitionUniform(m->n, processes);
+    if (!options.balanced) {
+        return uniform;
+    }
+    auto weights = split_by_columns ? m->ValuesPerColumn() : m->ValuesPerRow();
+    auto balanced = matrix::PartitionBalanced(weights, processes);
+    std::cerr << "Load imbalance of A (max/mean values per process): uniform "
+              << matrix::PartitionImbalance(weights, uniform) << ", balanced "
+              << matrix::PartitionImbalance(weights, balanced) << std::endl;
+    return balanced;
+}
+
+std::unique_ptr<matrix::Sparse> reorder_sparse(std::unique_ptr<matrix::Sparse> m, const std::vector<int> &permutation) {
+    auto reordered = reorder::Permute(m.get(), permutation);
+    // Panel width used to compare the local kernel before and after reordering.
+    const int kernel_columns = 16;
+    double kernel_before = matrix::MultiplyTime(m.get(), kernel_columns);
+    double kernel_after = matrix::MultiplyTime(reordered.get(), kernel_columns);
+    std::cerr << "Reordering of A: bandwidth " << reorder::Bandwidth(m.get()) << " -> "
+              << reorder::Bandwidth(reordered.get()) << ", profile " << reorder::Profile(m.get()) << " -> "
+              << reorder::Profile(reordered.get()) << ", local kernel " << kernel_before << "s -> " << kernel_after
+              << "s (speedup " << kernel_before / kernel_after << ")" << std::endl;
+    return reordered;
+}
+
 Algorithm::Algorithm(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com, int replication_factor,
-    int seed, bool split_by_columns) {
+    const std::vector<int> &seeds, bool split_by_columns, const Options &options) {
     // Replicate Matrix A over the replication group.
     communicator = com;
     c = replication_factor;
     // Replicate Matrix A over the replication group.
-    if (communicator->isCoordinator()) {
+    if (options.generator.n > 0) {
+        generateA(options.generator, split_by_columns);
+    } else if (communicator->isCoordinator()) {
         n = full_matrix->n;
         communicator->BroadcastSendN(n);
-        auto matricesA = full_matrix->Split(communicator->numProcesses(), split_by_columns);
+        if (options.reordering != reorder::NONE) {
+            permutation = reorder::Permutation(full_matrix.get(), options.reordering);
+            full_matrix = reorder_sparse(std::move(full_matrix), permutation);
+            communicator->BroadcastSendInts(permutation);
+        }
+        // Only the upper triangle of a symmetric matrix is stored (after reordering, which keeps it symmetric).
+        if (options.symmetry != GENERAL) {
+            symmetric = options.symmetry == SYMMETRIC || matrix::IsSymmetric(full_matrix.get());
+            if (symmetric) {
+                auto upper = matrix::UpperTriangle(full_matrix.get());
+                std::cerr << "Symmetric A: storing " << upper->values.size() << " of " << full_matrix->values.size()
+                          << " values" << std::endl;
+                full_matrix = std::move(upper);
+            } else {
+                std::cerr << "A is not symmetric, it is stored as a whole." << std::endl;
+            }
+        }
+        communicator->BroadcastSendN(symmetric);
+        partitionA = partition_sparse(full_matrix.get(), communicator->numProcesses(), split_by_columns, options);
+        communicator->BroadcastSendInts(partitionA);
+        auto matricesA = full_matrix->Split(partitionA, split_by_columns);
         matrixA = std::make_unique<matrix::Sparse>(matricesA[0]);
         for (size_t i = 1; i < matricesA.size(); i++) {
             communicator->SendSparse(&matricesA[i], i, PHASE_INITIALIZATION);
         }
     } else {
         n = communicator->BroadcastReceiveN();
+        if (options.reordering != reorder::NONE) {
+            permutation = communicator->BroadcastReceiveInts(communicator->rankCoordinator());
+        }
+        symmetric = communicator->BroadcastReceiveN() != 0;
+        partitionA = communicator->BroadcastReceiveInts(communicator->rankCoordinator());
         matrixA = communicator->ReceiveSparse(communicator->rankCoordinator(), PHASE_INITIALIZATION);
     }
+    power_iteration = options.power_iteration;
+    tolerance = options.tolerance;
     n_original = n;
     // Determine if we should expand n due to layers.
     if (n % replication_factor != 0) {
         n = ((n / replication_factor) + 1) * replication_factor;
     }
-    // Prepare Matrix B and C.
-    matrixB = std::make_unique<matrix::Dense>(n, n_original, communicator->rank(), communicator->numProcesses(), seed);
-    matrixC = std::make_unique<matrix::Dense>(n, n_original, communicator->rank(), communicator->numProcesses());
+    // Out-of-core mode: a few chunks of A (being multiplied, read ahead, sent and received) fit in the budget.
+    if (options.memory_budget > 0) {
+        chunk_values = static_cast<size_t>(options.memory_budget / (4 * (sizeof(double) + sizeof(int))));
+    }
+    // Prepare Matrix B and C. Their columns stay split uniformly also with -b: every column of B costs the same
+    // (the whole A is multiplied by it), so the boundaries don't change the work of a process.
+    partitionB = matrix::PartitionUniform(n, communicator->numProcesses());
+    generateB(seeds);
 
     if (communicator->numProcesses() % replication_factor != 0) {
         throw std::runtime_error("p % c != 0");
     }
 }
 
-void Algorithm::phaseComputationPartial() {
-    auto it = matrix::SparseIt(matrixA.get());
-    auto b_range = matrixB->ColumnRange();
-    while (it.Next()) {
-        auto itv = it.Value();
+void Algorithm::generateA(const sparsematgen::Spec &spec, bool split_by_columns) {
+    n = spec.n;
+    int processes = communicator->numProcesses();
+    partitionA = matrix::PartitionUniform(n, processes);
+    auto rows = std::make_pair(partitionA[communicator->rank()], partitionA[communicator->rank() + 1]);
+    matrixA = sparsematgen::GenerateRows(spec, rows.first, rows.second);
+    if (!split_by_columns) {
+        return;
+    }
+    // Values are sent to the owners of their columns (as in Sparse::Split by columns).
+    std::vector<std::vector<int>> coordinates(processes);
+    std::vector<std::vector<double>> values(processes);
+    for (int r = rows.first; r < rows.second; r++) {
+        for (auto i = matrixA->rows_number_of_values[r]; i < matrixA->rows_number_of_values[r + 1]; i++) {
+            int receiver = matrix::PartitionOwner(partitionA, matrixA->values_column[i]);
+            coordinates[receiver].push_back(r);
+            coordinates[receiver].push_back(matrixA->values_column[i]);
+            values[receiver].push_back(matrixA->values[i]);
+        }
+    }
+    matrixA.reset();
+    std::vector<int> send_counts;
+    auto send_values = flatten(values, send_counts);
+    auto receive_counts = communicator->AllToAllCounts(send_counts);
+    auto received_values = communicator->AllToAllDoubles(send_values, send_counts, receive_counts);
+    auto send_coordinates = flatten(coordinates, send_counts);
+    for (auto &count : receive_counts) {
+        count *= 2;
+    }
+    auto received_coordinates = communicator->AllToAllInts(send_coordinates, send_counts, receive_counts);
+    matrixA = std::make_unique<matrix::Sparse>(n, received_coordinates, received_values);
+}
 
-        int ay = std::get<0>(itv);
-        int ax = std::get<1>(itv);
-        if (ax == -1 || ay == -1) {
-            continue;
+bool Algorithm::normalizeStep(int step, int copies) {
+    profile::Scope scope(profile::COMBINE);
+    size_t columns = static_cast<size_t>(n) * matrixC->batch;
+    if (step == 0) {
+        rayleigh.assign(columns, 0);
+    }
+    std::vector<double> moments(matrix::MOMENTS * columns, 0);
+    matrix::AddColumnMoments(matrixB.get(), matrixC.get(), rayleigh, moments);
+    communicator->AllReduceSumDoubles(moments);
+    // Copies of values cancel out in the ratios, only the norm has to be divided by their number.
+    std::vector<double> scales(columns, 1);
+    residual = 0;
+    for (size_t i = 0; i < columns; i++) {
+        const double *m = moments.data() + matrix::MOMENTS * i;
+        if (m[matrix::C_C] > 0) {
+            scales[i] = 1 / std::sqrt(m[matrix::C_C] / copies);
+            residual = std::max(residual, std::sqrt(m[matrix::RESIDUAL] / m[matrix::C_C]));
         }
+        rayleigh[i] = m[matrix::B_B] > 0 ? m[matrix::C_B] / m[matrix::B_B] : 0;
+    }
+    matrix::ScaleColumns(matrixC.get(), scales);
+    iterations = step + 1;
+    return residual < tolerance;
+}
 
-        double av = std::get<2>(itv);
+void Algorithm::scatterResult(messaging::Communicator &group, bool partial) {
+    if (group.numProcesses() == 1) {
+        return;
+    }
+    if (partial) {
+        profile::Scope scope(profile::COMBINE);
+        matrixC = group.ReduceScatterSumDense(matrixC.get());
+    } else {
+        matrixC = matrixC->Panel(group.rank());
+    }
+}
 
-        for (int bx = b_range.first; bx < b_range.second; bx++) {
-            double bv = matrixB->Get(bx, ax);
-            auto cv = av * bv;
-            matrixC->ItemAdd(bx, ay, cv);
+std::unique_ptr<matrix::Dense> Algorithm::initialB(const std::vector<int> &seeds) {
+    auto column_range = std::make_pair(partitionB[communicator->rank()], partitionB[communicator->rank() + 1]);
+    // B (and C) hold the same columns of every matrix of the batch, so that each shift of A serves all of them.
+    auto b = std::make_unique<matrix::Dense>(n, n_original, column_range, seeds);
+    // B has to be reordered the same way as A, so that the product is C reordered by rows.
+    if (!permutation.empty()) {
+        b->PermuteRows(permutation);
+    }
+    return b;
+}
+
+void Algorithm::generateB(const std::vector<int> &seeds) {
+    matrixB = initialB(seeds);
+    matrixC = std::make_unique<matrix::Dense>(n, n_original, std::make_pair(0, n), matrixB->ColumnRange(),
+                                              matrixB->batch);
+    matrixResults.reset();
+}
+
+void Algorithm::multiplyLocalA(matrix::Dense *b, matrix::Dense *c) {
+    auto multiply = [this, b, c](matrix::Sparse *a) {
+        if (symmetric) {
+            matrix::MultiplyAddSymmetric(a, b, c);
+        } else {
+            matrix::MultiplyAdd(a, b, c);
+        }
+    };
+    if (spilledA) {
+        spilledA->ForEachChunk(multiply);
+    } else {
+        multiply(matrixA.get());
+    }
+}
+
+std::vector<double> Algorithm::phaseVerify(const std::vector<int> &seeds, int power) {
+    // The same x on every process: its seed is drawn by the coordinator.
+    int seed;
+    if (communicator->isCoordinator()) {
+        seed = static_cast<int>(std::random_device()() & 0x7fffffff);
+        communicator->BroadcastSendN(seed);
+    } else {
+        seed = communicator->BroadcastReceiveN();
+    }
+    std::mt19937_64 random(seed);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    std::vector<double> x(n);
+    for (auto &value : x) {
+        value = uniform(random);
+    }
+
+    // B * x and C * x of the whole batch (as vectors of blocks of all rows, a column per matrix) with one reduction.
+    int batch = static_cast<int>(seeds.size());
+    size_t size = static_cast<size_t>(n) * batch;
+    std::vector<double> products(2 * size, 0);
+    matrix::MultiplyAddVector(initialB(seeds).get(), x, products.data());
+    matrix::MultiplyAddVector(matrixC.get(), x, products.data() + size);
+    communicator->AllReduceSumDoubles(products);
+
+    auto y = std::make_unique<matrix::Dense>(n, n_original, 0, 1, n,
+                                             matrix::Buffer<double>(products.begin(), products.begin() + size));
+    y->batch = batch;
+    for (int p = 0; p < power; p++) {
+        auto z = y->ZerosLike();
+        multiplyLocalA(y.get(), z.get());
+        communicator->AllReduceSumDense(z.get());
+        for (auto &value : z->values) {
+            value /= copiesA;
         }
+        y = std::move(z);
+    }
+
+    std::vector<double> error(batch, 0), norm(batch, 0);
+    for (size_t i = 0; i < size; i++) {
+        error[i % batch] = std::max(error[i % batch], std::abs(products[size + i] - y->values[i]));
+        norm[i % batch] = std::max(norm[i % batch], std::abs(y->values[i]));
+    }
+    for (int s = 0; s < batch; s++) {
+        error[s] = norm[s] > 0 ? error[s] / norm[s] : error[s];
+    }
+    return error;
+}
+
+void Algorithm::phaseNextJob(const std::vector<int> &seeds) {
+    generateB(seeds);
+    phaseReplicationB();
+}
+
+void Algorithm::replicateA(messaging::Communicator &comm) {
+    copiesA = comm.numProcesses();
+    if (chunk_values > 0) {
+        // Blocks of the group aren't merged, they are appended to the scratch file one by one. The own block is
+        // spilled first and broadcast chunk by chunk, so that no whole block is kept in memory.
+        auto own = std::make_unique<outofcore::SpilledSparse>(matrixA->n, chunk_values);
+        own->Append(matrixA.get());
+        matrixA.reset();
+        spilledA = outofcore::AllGather(&comm, own.get());
+        return;
+    }
+    auto matrixA_copy = *matrixA;
+    // At this point, `comm` is a communicator used within replication group.
+    for (int i = 0; i < comm.numProcesses(); i++) {
+        if (i == comm.rank()) {
+            comm.BroadcastSendSparse(&matrixA_copy);
+        } else {
+            auto b = comm.BroadcastReceiveSparse(i);
+            profile::TraceScope trace("merge A");
+            matrixA = std::make_unique<matrix::Sparse>(matrixA.get(), b.get());
+        }
+    }
+}
+
+void Algorithm::multiplyAdd(matrix::Sparse *a, matrix::Dense *b, matrix::Dense *c) {
+    if (symmetric) {
+        matrix::MultiplyAddSymmetric(a, b, c, &epochsC);
+    } else {
+        matrix::MultiplyAdd(a, b, c, &epochsC);
     }
 }
 
+void Algorithm::phaseComputationPartial() {
+    profile::Scope scope(profile::MULTIPLY);
+    if (spilledA) {
+        spilledA->ForEachChunk([this](matrix::Sparse *chunk) {
+            multiplyAdd(chunk, matrixB.get(), matrixC.get());
+        });
+        return;
+    }
+    multiplyAdd(matrixA.get(), matrixB.get(), matrixC.get());
+}
+
 void Algorithm::phaseComputationCycleA(messaging::Communicator *comm) {
+    profile::Scope scope(profile::SHIFT);
+    // There is nobody to exchange A with (and sending to itself could block).
+    if (comm->numProcesses() == 1) {
+        return;
+    }
     int sender = comm->rank() - 1;
     if (sender == -1) {
         sender = comm->numProcesses() - 1;
     }
     int receiver = (comm->rank() + 1) % (comm->numProcesses());
-    if (comm->rank() % 2 == 0) {
-        comm->SendSparse(matrixA.get(), receiver, PHASE_COMPUTATION);
-        matrixA = comm->ReceiveSparse(sender, PHASE_COMPUTATION);
-    } else {
-        auto ma = comm->ReceiveSparse(sender, PHASE_COMPUTATION);
-        comm->SendSparse(matrixA.get(), receiver, PHASE_COMPUTATION);
-        matrixA = std::move(ma);
-    }
-}
-
-void Algorithm::phaseFinalGE(double g) {
-    // Count how many values greater or equal to `g` is in the part of the result.
-    long counter = 0;
-    int i = 0;
-    for (int row = 0; row < matrixC->n_original; row++) {
-        for (int col = 0; col < matrixC->columns_total; col++) {
-            if (matrixC->column_base <= col && col < matrixC->column_base + matrixC->columns) {
-                if (col >= matrixC->n_original) {
-                    i++;
-                    continue;
-                }
-                if (matrixC->values[i++] >= g) {
-                    counter += 1;
-                }
-            }
+    if (spilledA) {
+        spilledA = outofcore::Shift(comm, spilledA.get(), sender, receiver, PHASE_COMPUTATION);
+        return;
+    }
+    if (!bufferA) {
+        // Both buffers can hold the largest block of A in the ring, so shifts don't allocate memory.
+        auto values = static_cast<size_t>(comm->AllReduceMax(matrixA->values.size()));
+        auto rows = static_cast<size_t>(comm->AllReduceMax(matrixA->rows_number_of_values.size()));
+        bufferA = std::make_unique<matrix::Sparse>(matrixA->n, matrix::Buffer<double>(),
+                                                   matrix::Buffer<matrix::index_t>(), matrix::Buffer<int>());
+        for (auto m : {matrixA.get(), bufferA.get()}) {
+            m->values.reserve(values);
+            m->values_column.reserve(values);
+            m->rows_number_of_values.reserve(rows);
         }
     }
-    // Send the counters to coordinator and print out the results.
-    if (communicator->isCoordinator()) {
-        // TODO: use MPI Reduce
-        // https://mpitutorial.com/tutorials/mpi-reduce-and-allreduce/
-        for (int p = 1; p < communicator->numProcesses(); p++)
-            counter += communicator->ReceiveN(p, PHASE_FINAL);
-        // Print out the result to stdout.
-        std::cout << counter << std::endl;
-    } else {
-        communicator->SendN(counter, communicator->rankCoordinator(), PHASE_FINAL);
+    comm->ShiftSparse(matrixA, bufferA, sender, receiver, PHASE_COMPUTATION);
+}
+
+void Algorithm::printFinalMatrix(std::unique_ptr<matrix::Dense> m) {
+    // Restore the original order of rows if A was reordered.
+    if (!permutation.empty()) {
+        m->PermuteRows(reorder::PermutationInverse(permutation));
     }
+    std::cout << m->n_original << " " << m->n_original << "\n";
+    std::cout.flush();
+    matrix::Print(*m, stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+void Algorithm::selectResult(int batch_index) {
+    if (!matrixResults) {
+        matrixResults = std::move(matrixC);
+    }
+    matrixC = matrixResults->Extract(batch_index);
+}
+
+std::vector<matrix::Statistics> Algorithm::phaseFinalStatistics(double g, const matrix::HistogramRange &histogram) {
+    // Reordering of A only permutes rows of C, so it does not change the statistics.
+    // Results of the batch are interleaved in the rows of C, so all of them are computed in the same pass.
+    auto results = matrixResults ? matrixResults.get() : matrixC.get();
+    auto statistics = matrix::BatchStatistics(results, g, histogram);
+    statistics = communicator->ReduceStatistics(statistics);
+    for (auto &st : statistics) {
+        st.AddZeros(static_cast<long>(n_original) * n_original - st.count, g, histogram);
+    }
+    return statistics;
+}
+
+void Algorithm::phaseFinalFile(const std::string &path) {
+    auto results = matrixResults ? matrixResults.get() : matrixC.get();
+    communicator->WriteDenseFile(path, results, permutation);
 }
 
 void AlgorithmCOLA::phaseFinalMatrix() {
     // Divide the processes into replication groups.
     int divider = communicator->rank() / c;
-    auto comm_replication = communicator->Split(divider);
+    auto &comm_replication = communicator->Group("consecutive", divider);
     std::vector<std::unique_ptr<matrix::Dense>> matrices;
     // Firstly, send results to the replication group leader.
     if (comm_replication.isCoordinator()) {
@@ -133,7 +418,7 @@ void AlgorithmCOLA::phaseFinalMatrix() {
     }
 
     // Merge results received from replication groups.
-    auto replication_result = matrix::Merge(std::move(matrices));
+    auto replication_result = merge(std::move(matrices));
     // Free memory / prepare vector for next pushes. (Solely for reader's clarity - look up move above.)
     matrices.clear();
 
@@ -149,9 +434,7 @@ void AlgorithmCOLA::phaseFinalMatrix() {
         }
         // Coordinator: all parts where received.
         // Coordinator: print out the Matrix.
-        auto final_result = matrix::Merge(std::move(matrices));
-        std::cout << final_result->n_original << " " << final_result->n_original << std::endl;
-        std::cout << *final_result << std::endl;
+        printFinalMatrix(merge(std::move(matrices)));
     } else {
         // Not a coordinator: send managed part to the coordinator.
         communicator->SendDense(replication_result.get(), communicator->rankCoordinator(), PHASE_FINAL);
@@ -159,44 +442,45 @@ void AlgorithmCOLA::phaseFinalMatrix() {
 }
 
 AlgorithmCOLA::AlgorithmCOLA(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com,
-    int replication_factor, int seed) : Algorithm(std::move(full_matrix), com, replication_factor, seed, true) { }
+    int replication_factor, const std::vector<int> &seeds, const Options &options) :
+    Algorithm(std::move(full_matrix), com, replication_factor, seeds, true, options) { }
 
 void AlgorithmCOLA::phaseReplication() {
     // Replicate Matrix A (this algorithm only replicates Matrix A).
-    auto matrixA_copy = *matrixA;
     // Group processes which are next to each other together (012 345 678 ...).
     int divider = communicator->rank() / c;
-    auto comm_replication = communicator->Split(divider);
-    // At this point, `comm_replication` is a communicator used within replication group.
-    for (int i = 0; i < comm_replication.numProcesses(); i++) {
-        if (i == comm_replication.rank()) {
-            comm_replication.BroadcastSendSparse(&matrixA_copy);
-        } else {
-            auto b = comm_replication.BroadcastReceiveSparse(i);
-            matrixA = std::make_unique<matrix::Sparse>(matrixA.get(), b.get());
-        }
-    }
+    replicateA(communicator->Group("consecutive", divider));
+    phaseReplicationB();
+}
+
+void AlgorithmCOLA::phaseReplicationB() {
+    // B and C are not replicated, they stay in the initial distribution.
 }
 
 void AlgorithmCOLA::phaseComputation(int power) {
-    auto comm_computation = communicator->Split(communicator->rank() % c);
+    auto &comm_computation = communicator->Group("strided", communicator->rank() % c);
     for (int p = 0; p < power; p++) {
+        epochsC.Next(matrixC->rows);
         for (int i = 0; i < comm_computation.numProcesses(); i++) {
+            profile::SetPosition(p, i);
             phaseComputationPartial();
             phaseComputationCycleA(&comm_computation);
         }
-        // Swap Matrix B with Matrix C.
-        auto mb = std::move(matrixB);
-        matrixB = std::move(matrixC);
-        std::fill(mb->values.begin(), mb->values.end(), 0);
-        matrixC = std::move(mb);
+        matrix::ZeroStaleRows(matrixC.get(), epochsC);
+        bool converged = power_iteration && normalizeStep(p, 1);
+        // Swap Matrix B with Matrix C (it is overwritten by the next multiplication, so it isn't zeroed).
+        std::swap(matrixB, matrixC);
+        if (converged) {
+            break;
+        }
     }
+    profile::SetPosition(-1, -1);
     matrixC = std::move(matrixB);
 }
 
 AlgorithmInnerABC::AlgorithmInnerABC(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com,
-                                 int replication_factor, int seed) :
-                                 Algorithm(std::move(full_matrix), com, replication_factor, seed, false) {
+                                 int replication_factor, const std::vector<int> &seeds, const Options &options) :
+                                 Algorithm(std::move(full_matrix), com, replication_factor, seeds, false, options) {
     if (communicator->numProcesses() % (replication_factor*replication_factor) != 0) {
         throw std::runtime_error("p % c^2 != 0");
     }
@@ -204,21 +488,15 @@ AlgorithmInnerABC::AlgorithmInnerABC(std::unique_ptr<matrix::Sparse> full_matrix
 
 void AlgorithmInnerABC::phaseReplication() {
     // Replicate A.
-    auto matrixA_copy = *matrixA;
     auto divider = group_divider(communicator->rank(), c, communicator->numProcesses());
-    auto comm_replication_a = communicator->Split(divider.second);
-    // At this point, `comm_replication` is a communicator used within replication group.
-    for (int i = 0; i < comm_replication_a.numProcesses(); i++) {
-        if (i == comm_replication_a.rank()) {
-            comm_replication_a.BroadcastSendSparse(&matrixA_copy);
-        } else {
-            auto b = comm_replication_a.BroadcastReceiveSparse(i);
-            matrixA = std::make_unique<matrix::Sparse>(matrixA.get(), b.get());
-        }
-    }
+    replicateA(communicator->Group("inner", divider.second));
+    phaseReplicationB();
+}
 
+void AlgorithmInnerABC::phaseReplicationB() {
     // Replicate B / C.
-    auto comm_replication_b = communicator->Split(divider.first);
+    auto divider = group_divider(communicator->rank(), c, communicator->numProcesses());
+    auto &comm_replication_b = communicator->Group("consecutive", divider.first);
     matrix::Denses matrices_b;
     for (int i = 0; i < comm_replication_b.numProcesses(); i++) {
         if (i == comm_replication_b.rank()) {
@@ -229,31 +507,59 @@ void AlgorithmInnerABC::phaseReplication() {
             matrices_b.push_back(std::move(b));
         }
     }
-    matrixB = matrix::Merge(std::move(matrices_b));
-    matrixC = std::make_unique<matrix::Dense>(matrixB->rows, n_original, matrixB->ColumnRange());
+    // Blocks of the group become panels of B, C has the same layout.
+    matrixB = merge(std::move(matrices_b));
+    matrixC = matrixB->ZerosLike();
 }
 
 void AlgorithmInnerABC::phaseComputation(int power) {
-    auto comm_replication_a = communicator->Split(communicator->rank() % c);
+    auto &comm_replication_a = communicator->Group("strided", communicator->rank() % c);
+    auto divider = group_divider(communicator->rank(), c, communicator->numProcesses());
+    auto &comm_replication_b = communicator->Group("consecutive", divider.first);
     int rounds = communicator->numProcesses() / (c*c);
+    // Rounds don't make a full cycle of the ring, so A has to be restored for the next job.
+    if (spilledA) {
+        spilledAInitial = spilledA;
+    } else if (!matrixAInitial) {
+        matrixAInitial = std::make_unique<matrix::Sparse>(*matrixA);
+    }
     for (int i = 0; i < power; i++) {
+        epochsC.Next(matrixC->rows);
         for (int j = 0; j < rounds; j++) {
+            profile::SetPosition(i, j);
             phaseComputationPartial();
             phaseComputationCycleA(&comm_replication_a);
         }
-        // Swap Matrix B with Matrix C.
-        auto mb = std::move(matrixB);
-        matrixB = std::move(matrixC);
-        std::fill(mb->values.begin(), mb->values.end(), 0);
-        matrixC = std::move(mb);
+        matrix::ZeroStaleRows(matrixC.get(), epochsC);
+        // Processes of the replication group computed different rows of C (with symmetric A, transposed values
+        // contribute to rows of the other members too). Sum them up, so that every one of them has the whole B
+        // for the next multiplication. The last results are summed by scatterResult (unless the power iteration
+        // needs the whole C after every multiplication).
+        if ((i + 1 < power || power_iteration) && comm_replication_b.numProcesses() > 1) {
+            profile::Scope scope(profile::COMBINE);
+            comm_replication_b.AllReduceSumDense(matrixC.get());
+        }
+        bool converged = power_iteration && normalizeStep(i, comm_replication_b.numProcesses());
+        // Swap Matrix B with Matrix C (it is overwritten by the next multiplication, so it isn't zeroed).
+        std::swap(matrixB, matrixC);
+        if (converged) {
+            break;
+        }
     }
+    profile::SetPosition(-1, -1);
     matrixC = std::move(matrixB);
+    if (spilledA) {
+        spilledA = spilledAInitial;
+    } else {
+        *matrixA = *matrixAInitial;
+    }
+    scatterResult(comm_replication_b, power > 0 && !power_iteration);
 }
 
 void AlgorithmInnerABC::phaseFinalMatrix() {
     // Divide the processes into replication groups.
     auto divider = group_divider(communicator->rank(), c, communicator->numProcesses());
-    auto comm_replication = communicator->Split(divider.first);
+    auto &comm_replication = communicator->Group("consecutive", divider.first);
     std::vector<std::unique_ptr<matrix::Dense>> matrices;
     // Firstly, send results to the replication group leader.
     if (comm_replication.isCoordinator()) {
@@ -272,7 +578,7 @@ void AlgorithmInnerABC::phaseFinalMatrix() {
     }
 
     // Merge results received from replication groups.
-    auto replication_result = matrix::Merge(std::move(matrices));
+    auto replication_result = merge(std::move(matrices));
     // Free memory / prepare vector for next pushes. (Solely for reader's clarity - look up move above.)
     matrices.clear();
 
@@ -288,13 +594,513 @@ void AlgorithmInnerABC::phaseFinalMatrix() {
         }
         // Coordinator: all parts where received.
         // Coordinator: print out the Matrix.
-        auto final_result = matrix::Merge(std::move(matrices));
-        std::cout << final_result->n_original << " " << final_result->n_original << std::endl;
-        std::cout << *final_result << std::endl;
+        printFinalMatrix(merge(std::move(matrices)));
     } else {
         // Not a coordinator: send managed part to the coordinator.
         communicator->SendDense(replication_result.get(), communicator->rankCoordinator(), PHASE_FINAL);
     }
 }
 
+AlgorithmCOLB::AlgorithmCOLB(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com,
+    int replication_factor, const std::vector<int> &seeds, const Options &options) :
+    Algorithm(std::move(full_matrix), com, replication_factor, seeds, false, options) {
+    if (chunk_values > 0) {
+        throw std::runtime_error("Out-of-core mode is supported only by cola and inner.");
+    }
+}
+
+void AlgorithmCOLB::phaseReplication() {
+    // This algorithm doesn't replicate Matrix A.
+    phaseReplicationB();
+}
+
+void AlgorithmCOLB::phaseReplicationB() {
+    // Replicate B / C.
+    // Group processes which are next to each other together (012 345 678 ...).
+    auto &comm_replication = communicator->Group("consecutive", communicator->rank() / c);
+    matrix::Denses matrices_b;
+    for (int i = 0; i < comm_replication.numProcesses(); i++) {
+        if (i == comm_replication.rank()) {
+            comm_replication.BroadcastSendDense(matrixB.get());
+            matrices_b.push_back(std::move(matrixB));
+        } else {
+            auto b = comm_replication.BroadcastReceiveDense(i);
+            matrices_b.push_back(std::move(b));
+        }
+    }
+    // Blocks of the group become panels of B, C has the same layout.
+    matrixB = merge(std::move(matrices_b));
+    matrixC = matrixB->ZerosLike();
+}
+
+void AlgorithmCOLB::phaseComputation(int power) {
+    // Processes with the same position in their replication groups shift A between each other.
+    // Every one of them sees a different set of rows of A, so the replication group computes
+    // disjoint parts of C, which are summed up at the end of each multiplication.
+    auto &comm_computation = communicator->Group("strided", communicator->rank() % c);
+    auto &comm_replication = communicator->Group("consecutive", communicator->rank() / c);
+    for (int p = 0; p < power; p++) {
+        epochsC.Next(matrixC->rows);
+        for (int i = 0; i < comm_computation.numProcesses(); i++) {
+            profile::SetPosition(p, i);
+            phaseComputationPartial();
+            phaseComputationCycleA(&comm_computation);
+        }
+        matrix::ZeroStaleRows(matrixC.get(), epochsC);
+        // The last results are summed by scatterResult (unless the power iteration needs the whole C).
+        if ((p + 1 < power || power_iteration) && comm_replication.numProcesses() > 1) {
+            profile::Scope scope(profile::COMBINE);
+            comm_replication.AllReduceSumDense(matrixC.get());
+        }
+        bool converged = power_iteration && normalizeStep(p, comm_replication.numProcesses());
+        // Swap Matrix B with Matrix C (it is overwritten by the next multiplication, so it isn't zeroed).
+        std::swap(matrixB, matrixC);
+        if (converged) {
+            break;
+        }
+    }
+    profile::SetPosition(-1, -1);
+    matrixC = std::move(matrixB);
+    scatterResult(comm_replication, power > 0 && !power_iteration);
+}
+
+void AlgorithmCOLB::phaseFinalMatrix() {
+    // Every process keeps its block of columns of the result (as in the initial distribution).
+    if (communicator->isCoordinator()) {
+        matrix::Denses matrices;
+        matrices.push_back(std::move(matrixC));
+        // Coordinator: receive parts from every other process.
+        for (int i = 1; i < communicator->numProcesses(); i++) {
+            auto m = communicator->ReceiveDense(i, PHASE_FINAL);
+            matrices.push_back(std::move(m));
+        }
+        printFinalMatrix(merge(std::move(matrices)));
+    } else {
+        communicator->SendDense(matrixC.get(), communicator->rankCoordinator(), PHASE_FINAL);
+    }
+}
+
+AlgorithmSUMMA::AlgorithmSUMMA(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com,
+    int replication_factor, const std::vector<int> &seeds, const Options &options) :
+    Algorithm(std::move(full_matrix), com, replication_factor, seeds, false, options) {
+    if (chunk_values > 0) {
+        throw std::runtime_error("Out-of-core mode is supported only by cola and inner.");
+    }
+    // Blocks of the grid store only parts of rows of B and C, so values of A can't be applied transposed.
+    if (symmetric) {
+        throw std::runtime_error("Symmetric mode is not supported by summa.");
+    }
+    int processes = communicator->numProcesses();
+    q = static_cast<int>(std::lround(std::sqrt(processes / c)));
+    if (q * q * c != processes) {
+        throw std::runtime_error("p / c is not a square of an integer");
+    }
+    layer = communicator->rank() / (q * q);
+    grid_row = (communicator->rank() % (q * q)) / q;
+    grid_column = communicator->rank() % q;
+    partitionGrid = matrix::PartitionUniform(n, q);
+}
+
+int AlgorithmSUMMA::gridRank(int l, int i, int j) {
+    return (l * q + i) * q + j;
+}
+
+void AlgorithmSUMMA::redistributeAToGrid() {
+    int processes = communicator->numProcesses();
+    // Every value is sent to the process (of the first layer) owning its block.
+    std::vector<std::vector<int>> coordinates(processes);
+    std::vector<std::vector<double>> values(processes);
+    auto it = matrix::SparseIt(matrixA.get());
+    while (it.Next()) {
+        auto v = it.Value();
+        int receiver = gridRank(0, matrix::PartitionOwner(partitionGrid, std::get<0>(v)),
+                                matrix::PartitionOwner(partitionGrid, std::get<1>(v)));
+        coordinates[receiver].push_back(std::get<0>(v));
+        coordinates[receiver].push_back(std::get<1>(v));
+        values[receiver].push_back(std::get<2>(v));
+    }
+    std::vector<int> send_counts;
+    auto send_values = flatten(values, send_counts);
+    auto receive_counts = communicator->AllToAllCounts(send_counts);
+    auto received_values = communicator->AllToAllDoubles(send_values, send_counts, receive_counts);
+    auto send_coordinates = flatten(coordinates, send_counts);
+    for (auto &count : receive_counts) {
+        count *= 2;
+    }
+    auto received_coordinates = communicator->AllToAllInts(send_coordinates, send_counts, receive_counts);
+    matrixA = std::make_unique<matrix::Sparse>(matrixA->n, received_coordinates, received_values);
+}
+
+void AlgorithmSUMMA::redistributeBToGrid() {
+    int processes = communicator->numProcesses();
+    // Every process sends the intersections of its columns with blocks of the grid.
+    std::vector<std::vector<double>> blocks(processes);
+    auto columns = matrixB->ColumnRange();
+    for (int i = 0; i < q; i++) {
+        for (int j = 0; j < q; j++) {
+            int column_first = std::max(columns.first, partitionGrid[j]);
+            int column_last = std::min(columns.second, partitionGrid[j + 1]);
+            auto &block = blocks[gridRank(0, i, j)];
+            for (int y = partitionGrid[i]; y < partitionGrid[i + 1]; y++) {
+                for (int s = 0; s < matrixB->batch; s++) {
+                    for (int x = column_first; x < column_last; x++) {
+                        block.push_back(matrixB->Get(x, y, s));
+                    }
+                }
+            }
+        }
+    }
+    std::vector<int> send_counts;
+    auto send_blocks = flatten(blocks, send_counts);
+    auto receive_counts = communicator->AllToAllCounts(send_counts);
+    auto received_blocks = communicator->AllToAllDoubles(send_blocks, send_counts, receive_counts);
+    auto row_range = std::make_pair(partitionGrid[grid_row], partitionGrid[grid_row + 1]);
+    auto column_range = std::make_pair(partitionGrid[grid_column], partitionGrid[grid_column + 1]);
+    matrixB = std::make_unique<matrix::Dense>(n, n_original, row_range, column_range, matrixB->batch);
+    if (layer == 0) {
+        size_t i = 0;
+        for (int sender = 0; sender < processes; sender++) {
+            int column_first = std::max(column_range.first, partitionB[sender]);
+            int column_last = std::min(column_range.second, partitionB[sender + 1]);
+            for (int y = row_range.first; y < row_range.second; y++) {
+                for (int s = 0; s < matrixB->batch; s++) {
+                    for (int x = column_first; x < column_last; x++) {
+                        matrixB->Set(x, y, received_blocks[i++], s);
+                    }
+                }
+            }
+        }
+        assert(i == received_blocks.size());
+    }
+}
+
+void AlgorithmSUMMA::redistributeFromGrid() {
+    int processes = communicator->numProcesses();
+    // Only the first layer sends its blocks of C (all of the layers store the same result).
+    std::vector<std::vector<double>> blocks(processes);
+    if (layer == 0) {
+        for (int receiver = 0; receiver < processes; receiver++) {
+            int column_first = std::max(matrixC->column_base, partitionB[receiver]);
+            int column_last = std::min(matrixC->column_base + matrixC->columns, partitionB[receiver + 1]);
+            for (int y = matrixC->row_base; y < matrixC->row_base + matrixC->rows; y++) {
+                for (int s = 0; s < matrixC->batch; s++) {
+                    for (int x = column_first; x < column_last; x++) {
+                        blocks[receiver].push_back(matrixC->Get(x, y, s));
+                    }
+                }
+            }
+        }
+    }
+    std::vector<int> send_counts;
+    auto send_blocks = flatten(blocks, send_counts);
+    auto receive_counts = communicator->AllToAllCounts(send_counts);
+    auto received_blocks = communicator->AllToAllDoubles(send_blocks, send_counts, receive_counts);
+
+    auto column_range = std::make_pair(partitionB[communicator->rank()], partitionB[communicator->rank() + 1]);
+    matrixC = std::make_unique<matrix::Dense>(n, n_original, std::make_pair(0, n), column_range, matrixC->batch);
+    size_t it = 0;
+    for (int i = 0; i < q; i++) {
+        for (int j = 0; j < q; j++) {
+            int column_first = std::max(column_range.first, partitionGrid[j]);
+            int column_last = std::min(column_range.second, partitionGrid[j + 1]);
+            for (int y = partitionGrid[i]; y < partitionGrid[i + 1]; y++) {
+                for (int s = 0; s < matrixC->batch; s++) {
+                    for (int x = column_first; x < column_last; x++) {
+                        matrixC->Set(x, y, received_blocks[it++], s);
+                    }
+                }
+            }
+        }
+    }
+    assert(it == received_blocks.size());
+}
+
+void AlgorithmSUMMA::phaseReplication() {
+    // Firstly, move A from the initial distribution to the blocks of the first layer of the grid.
+    redistributeAToGrid();
+    // Secondly, replicate the blocks over the layers.
+    auto &comm_depth = communicator->Group("grid_depth", grid_row * q + grid_column);
+    copiesA = comm_depth.numProcesses();
+    if (comm_depth.numProcesses() > 1) {
+        if (comm_depth.isCoordinator()) {
+            comm_depth.BroadcastSendSparse(matrixA.get());
+        } else {
+            matrixA = comm_depth.BroadcastReceiveSparse(comm_depth.rankCoordinator());
+        }
+    }
+    phaseReplicationB();
+}
+
+void AlgorithmSUMMA::phaseReplicationB() {
+    // The same for B.
+    redistributeBToGrid();
+    auto &comm_depth = communicator->Group("grid_depth", grid_row * q + grid_column);
+    if (comm_depth.numProcesses() > 1) {
+        if (comm_depth.isCoordinator()) {
+            comm_depth.BroadcastSendDense(matrixB.get());
+        } else {
+            matrixB = comm_depth.BroadcastReceiveDense(comm_depth.rankCoordinator());
+        }
+    }
+    matrixC = std::make_unique<matrix::Dense>(n, n_original, matrixB->RowRange(), matrixB->ColumnRange(),
+                                              matrixB->batch);
+}
+
+void AlgorithmSUMMA::phaseComputation(int power) {
+    auto &comm_row = communicator->Group("grid_row", layer * q + grid_row);
+    auto &comm_column = communicator->Group("grid_column", layer * q + grid_column);
+    auto &comm_depth = communicator->Group("grid_depth", grid_row * q + grid_column);
+    for (int p = 0; p < power; p++) {
+        epochsC.Next(matrixC->rows);
+        // Layers split the stages of SUMMA between each other.
+        for (int k = layer; k < q; k += c) {
+            profile::SetPosition(p, k);
+            // Stage k: A(i, k) is broadcast along the rows of the grid, B(k, j) along the columns.
+            std::unique_ptr<matrix::Sparse> a_received;
+            std::unique_ptr<matrix::Dense> b_received;
+            auto a = matrixA.get();
+            auto b = matrixB.get();
+            {
+                profile::Scope scope(profile::SHIFT);
+                if (grid_column == k) {
+                    comm_row.BroadcastSendSparse(a);
+                } else {
+                    a_received = comm_row.BroadcastReceiveSparse(k);
+                    a = a_received.get();
+                }
+                if (grid_row == k) {
+                    comm_column.BroadcastSendDense(b);
+                } else {
+                    b_received = comm_column.BroadcastReceiveDense(k);
+                    b = b_received.get();
+                }
+            }
+            profile::Scope scope(profile::MULTIPLY);
+            matrix::MultiplyAdd(a, b, matrixC.get(), &epochsC);
+        }
+        matrix::ZeroStaleRows(matrixC.get(), epochsC);
+        // Sum up partial results of the layers.
+        if (comm_depth.numProcesses() > 1) {
+            profile::Scope scope(profile::COMBINE);
+            comm_depth.AllReduceSumDense(matrixC.get());
+        }
+        bool converged = power_iteration && normalizeStep(p, comm_depth.numProcesses());
+        // Swap Matrix B with Matrix C (it is overwritten by the next multiplication, so it isn't zeroed).
+        std::swap(matrixB, matrixC);
+        if (converged) {
+            break;
+        }
+    }
+    profile::SetPosition(-1, -1);
+    matrixC = std::move(matrixB);
+    // Return to the initial distribution of C (blocks of columns).
+    redistributeFromGrid();
+}
+
+void AlgorithmSUMMA::phaseFinalMatrix() {
+    if (communicator->isCoordinator()) {
+        matrix::Denses matrices;
+        matrices.push_back(std::move(matrixC));
+        for (int i = 1; i < communicator->numProcesses(); i++) {
+            auto m = communicator->ReceiveDense(i, PHASE_FINAL);
+            matrices.push_back(std::move(m));
+        }
+        printFinalMatrix(merge(std::move(matrices)));
+    } else {
+        communicator->SendDense(matrixC.get(), communicator->rankCoordinator(), PHASE_FINAL);
+    }
+}
+
+AlgorithmSparse1D::AlgorithmSparse1D(std::unique_ptr<matrix::Sparse> full_matrix, messaging::Communicator *com,
+    int replication_factor, const std::vector<int> &seeds, const Options &options) :
+    Algorithm(std::move(full_matrix), com, replication_factor, seeds, false, options) {
+    if (c != 1) {
+        throw std::runtime_error("sparse doesn't replicate matrices, c must be 1");
+    }
+    if (chunk_values > 0) {
+        throw std::runtime_error("Out-of-core mode is supported only by cola and inner.");
+    }
+    // Transposed values would contribute to rows of C owned by other processes.
+    if (symmetric) {
+        throw std::runtime_error("Symmetric mode is not supported by sparse.");
+    }
+}
+
+void AlgorithmSparse1D::redistributeToRows() {
+    int processes = communicator->numProcesses();
+    // Every process sends the intersections of its columns with blocks of rows of the other processes.
+    std::vector<std::vector<double>> blocks(processes);
+    for (int receiver = 0; receiver < processes; receiver++) {
+        for (int y = partitionA[receiver]; y < partitionA[receiver + 1]; y++) {
+            for (int s = 0; s < matrixB->batch; s++) {
+                for (int x = matrixB->column_base; x < matrixB->column_base + matrixB->columns; x++) {
+                    blocks[receiver].push_back(matrixB->Get(x, y, s));
+                }
+            }
+        }
+    }
+    std::vector<int> send_counts;
+    auto send_blocks = flatten(blocks, send_counts);
+    auto receive_counts = communicator->AllToAllCounts(send_counts);
+    auto received_blocks = communicator->AllToAllDoubles(send_blocks, send_counts, receive_counts);
+
+    auto row_range = std::make_pair(partitionA[communicator->rank()], partitionA[communicator->rank() + 1]);
+    matrixB = std::make_unique<matrix::Dense>(n, n_original, row_range, std::make_pair(0, n), matrixB->batch);
+    size_t i = 0;
+    for (int sender = 0; sender < processes; sender++) {
+        for (int y = row_range.first; y < row_range.second; y++) {
+            for (int s = 0; s < matrixB->batch; s++) {
+                for (int x = partitionB[sender]; x < partitionB[sender + 1]; x++) {
+                    matrixB->Set(x, y, received_blocks[i++], s);
+                }
+            }
+        }
+    }
+    assert(i == received_blocks.size());
+}
+
+void AlgorithmSparse1D::redistributeToColumns() {
+    int processes = communicator->numProcesses();
+    std::vector<std::vector<double>> blocks(processes);
+    for (int receiver = 0; receiver < processes; receiver++) {
+        for (int y = matrixC->row_base; y < matrixC->row_base + matrixC->rows; y++) {
+            for (int s = 0; s < matrixC->batch; s++) {
+                for (int x = partitionB[receiver]; x < partitionB[receiver + 1]; x++) {
+                    blocks[receiver].push_back(matrixC->Get(x, y, s));
+                }
+            }
+        }
+    }
+    std::vector<int> send_counts;
+    auto send_blocks = flatten(blocks, send_counts);
+    auto receive_counts = communicator->AllToAllCounts(send_counts);
+    auto received_blocks = communicator->AllToAllDoubles(send_blocks, send_counts, receive_counts);
+
+    auto column_range = std::make_pair(partitionB[communicator->rank()], partitionB[communicator->rank() + 1]);
+    matrixC = std::make_unique<matrix::Dense>(n, n_original, std::make_pair(0, n), column_range, matrixC->batch);
+    size_t i = 0;
+    for (int sender = 0; sender < processes; sender++) {
+        for (int y = partitionA[sender]; y < partitionA[sender + 1]; y++) {
+            for (int s = 0; s < matrixC->batch; s++) {
+                for (int x = column_range.first; x < column_range.second; x++) {
+                    matrixC->Set(x, y, received_blocks[i++], s);
+                }
+            }
+        }
+    }
+    assert(i == received_blocks.size());
+}
+
+void AlgorithmSparse1D::phaseReplication() {
+    int processes = communicator->numProcesses();
+    // Rows of B referenced by the local block of A (in the increasing order).
+    auto &required = requiredRows;
+    required.assign(matrixA->values_column.begin(), matrixA->values_column.end());
+    std::sort(required.begin(), required.end());
+    required.erase(std::unique(required.begin(), required.end()), required.end());
+    // A is stationary, so its columns are renumbered once to positions of the rows of B in the received buffer.
+    std::vector<int> position(n, -1);
+    for (size_t i = 0; i < required.size(); i++) {
+        position[required[i]] = static_cast<int>(i);
+    }
+    for (auto &column : matrixA->values_column) {
+        column = position[column];
+    }
+
+    // Communication plan: rows requested from every owner and rows every process requested from us.
+    receiveRows.assign(processes, 0);
+    for (int row : required) {
+        receiveRows[matrix::PartitionOwner(partitionA, row)]++;
+    }
+    sendRows = communicator->AllToAllCounts(receiveRows);
+    sendRowIndices = communicator->AllToAllInts(required, receiveRows, sendRows);
+
+    double fraction = static_cast<double>(required.size()) / std::max(n, 1);
+    double max_fraction = communicator->AllReduceMax(fraction);
+    if (communicator->isCoordinator()) {
+        std::cerr << "Sparse 1D plan: a process receives at most " << max_fraction * 100
+                  << "% of rows of B in every multiplication" << std::endl;
+    }
+    phaseReplicationB();
+}
+
+void AlgorithmSparse1D::multiplyLocalA(matrix::Dense *b, matrix::Dense *c) {
+    // Columns of A are renumbered to positions of the required rows of B.
+    size_t width = static_cast<size_t>(b->columns) * b->batch;
+    matrix::Buffer<double> values(requiredRows.size() * width);
+    for (size_t i = 0; i < requiredRows.size(); i++) {
+        auto row = b->values.begin() + (requiredRows[i] - b->row_base) * width;
+        std::copy(row, row + width, values.begin() + i * width);
+    }
+    matrix::Dense required(static_cast<int>(requiredRows.size()), n_original, b->column_base, b->columns, n,
+                           std::move(values));
+    required.batch = b->batch;
+    matrix::MultiplyAdd(matrixA.get(), &required, c);
+}
+
+void AlgorithmSparse1D::phaseReplicationB() {
+    // B (and C) are split by rows the same way as A.
+    redistributeToRows();
+    matrixC = std::make_unique<matrix::Dense>(n, n_original, matrixB->RowRange(), matrixB->ColumnRange(),
+                                              matrixB->batch);
+}
+
+void AlgorithmSparse1D::phaseComputation(int power) {
+    assert(matrixB->Panels() == 1);
+    size_t width = static_cast<size_t>(matrixB->columns) * matrixB->batch;
+    std::vector<int> send_counts(sendRows.size()), receive_counts(receiveRows.size());
+    for (size_t i = 0; i < sendRows.size(); i++) {
+        send_counts[i] = all_to_all_count(sendRows[i] * width);
+        receive_counts[i] = all_to_all_count(receiveRows[i] * width);
+    }
+    std::vector<double> send(sendRowIndices.size() * width);
+    for (int p = 0; p < power; p++) {
+        // Send the requested rows of B, the received ones make a block of B in the order of renumbered columns of A.
+        profile::SetPosition(p, 0);
+        matrix::Buffer<double> received;
+        {
+            profile::Scope scope(profile::SHIFT);
+            for (size_t i = 0; i < sendRowIndices.size(); i++) {
+                auto row = matrixB->values.begin() + (sendRowIndices[i] - matrixB->row_base) * width;
+                std::copy(row, row + width, send.begin() + i * width);
+            }
+            received = communicator->AllToAllDoubles(send, send_counts, receive_counts);
+        }
+        matrix::Dense required(static_cast<int>(received.size() / std::max<size_t>(width, 1)), n_original,
+                               0, matrixB->columns, n, std::move(received));
+        required.batch = matrixB->batch;
+
+        epochsC.Next(matrixC->rows);
+        {
+            profile::Scope scope(profile::MULTIPLY);
+            matrix::MultiplyAdd(matrixA.get(), &required, matrixC.get(), &epochsC);
+        }
+        matrix::ZeroStaleRows(matrixC.get(), epochsC);
+        bool converged = power_iteration && normalizeStep(p, 1);
+        // Swap Matrix B with Matrix C (it is overwritten by the next multiplication, so it isn't zeroed).
+        std::swap(matrixB, matrixC);
+        if (converged) {
+            break;
+        }
+    }
+    profile::SetPosition(-1, -1);
+    matrixC = std::move(matrixB);
+    // Return to the initial distribution of C (blocks of columns).
+    redistributeToColumns();
+}
+
+void AlgorithmSparse1D::phaseFinalMatrix() {
+    if (communicator->isCoordinator()) {
+        matrix::Denses matrices;
+        matrices.push_back(std::move(matrixC));
+        for (int i = 1; i < communicator->numProcesses(); i++) {
+            auto m = communicator->ReceiveDense(i, PHASE_FINAL);
+            matrices.push_back(std::move(m));
+        }
+        printFinalMatrix(merge(std::move(matrices)));
+    } else {
+        communicator->SendDense(matrixC.get(), communicator->rankCoordinator(), PHASE_FINAL);
+    }
+}
+
 }
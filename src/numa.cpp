@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "numa.h"
+
+namespace numa {
+
+HugePages huge_pages = NO_HUGE_PAGES;
+
+// Every buffer is preceded by a header (padded to ALIGNMENT) describing how to free it.
+enum Kinds { ALIGNED, ADVISED, MAPPED };
+
+struct Header {
+    size_t bytes;  // Bytes of the buffer (with the header).
+    size_t mapped; // Bytes mapped (MAPPED only).
+    Kinds kind;
+};
+
+static_assert(sizeof(Header) <= ALIGNMENT, "The header must fit in the padding of a buffer.");
+
+Allocations &Stats() {
+    static Allocations allocations;
+    return allocations;
+}
+
+void SetHugePages(HugePages mode) {
+    huge_pages = mode;
+}
+
+size_t round_up(size_t bytes, size_t unit) {
+    return (bytes + unit - 1) / unit * unit;
+}
+
+void *aligned(size_t bytes, size_t alignment) {
+    void *base = nullptr;
+    if (posix_memalign(&base, alignment, bytes) != 0) {
+        throw std::bad_alloc();
+    }
+    return base;
+}
+
+void *Allocate(size_t bytes) {
+    size_t total = bytes + ALIGNMENT;
+    void *base = nullptr;
+    Header header = {total, 0, ALIGNED};
+    if (huge_pages != NO_HUGE_PAGES && total >= HUGE_PAGE_BYTES) {
+        if (huge_pages == EXPLICIT) {
+            header.mapped = round_up(total, HUGE_PAGE_BYTES);
+            base = mmap(nullptr, header.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                        -1, 0);
+            if (base == MAP_FAILED) {
+                base = nullptr;
+                Stats().huge_fallbacks++;
+            } else {
+                header.kind = MAPPED;
+            }
+        }
+        if (base == nullptr) {
+            base = aligned(round_up(total, HUGE_PAGE_BYTES), HUGE_PAGE_BYTES);
+            madvise(base, round_up(total, HUGE_PAGE_BYTES), MADV_HUGEPAGE);
+            header.kind = ADVISED;
+        }
+        Stats().huge_bytes += static_cast<long>(total);
+    } else {
+        base = aligned(total, ALIGNMENT);
+    }
+    *static_cast<Header *>(base) = header;
+
+    auto &stats = Stats();
+    stats.count++;
+    long current = stats.bytes += static_cast<long>(total);
+    long peak = stats.peak_bytes.load();
+    while (current > peak && !stats.peak_bytes.compare_exchange_weak(peak, current)) {
+    }
+    return static_cast<char *>(base) + ALIGNMENT;
+}
+
+void Free(void *pointer) {
+    if (pointer == nullptr) {
+        return;
+    }
+    void *base = static_cast<char *>(pointer) - ALIGNMENT;
+    Header header = *static_cast<Header *>(base);
+    Stats().bytes -= static_cast<long>(header.bytes);
+    if (header.kind == MAPPED) {
+        munmap(base, header.mapped);
+    } else {
+        free(base);
+    }
+}
+
+std::vector<int> cores() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        throw std::runtime_error("Couldn't read the affinity of the process.");
+    }
+    std::vector<int> result;
+    for (int core = 0; core < CPU_SETSIZE; core++) {
+        if (CPU_ISSET(core, &set)) {
+            result.push_back(core);
+        }
+    }
+    return result;
+}
+
+std::vector<int> Pin(Affinity affinity, int local_rank, int local_size) {
+    std::vector<int> available = cores();
+    if (affinity == NO_AFFINITY || available.empty()) {
+        return available;
+    }
+    int count = static_cast<int>(available.size());
+    std::vector<int> chosen;
+    if (affinity == COMPACT) {
+        int share = std::max(1, count / local_size);
+        int first = local_rank * share % count;
+        chosen.assign(available.begin() + first, available.begin() + std::min(count, first + share));
+    } else {
+        for (int i = local_rank % count; i < count; i += local_size) {
+            chosen.push_back(available[i]);
+        }
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int core : chosen) {
+        CPU_SET(core, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        throw std::runtime_error("Couldn't pin the process to its cores.");
+    }
+    return chosen;
+}
+
+// NUMA node of the core, -1 if it isn't known.
+int node_of(int core) {
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(core);
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return -1;
+    }
+    int node = -1;
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "node") == 0 && name.size() > 4 && std::isdigit(name[4])) {
+            node = std::atoi(name.c_str() + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+std::string DescribeAffinity() {
+    std::vector<int> pinned = cores();
+    std::ostringstream text;
+    text << "cores ";
+    std::set<int> nodes;
+    for (size_t i = 0; i < pinned.size(); i++) {
+        // Consecutive cores are written as ranges.
+        size_t last = i;
+        while (last + 1 < pinned.size() && pinned[last + 1] == pinned[last] + 1) {
+            last++;
+        }
+        text << (i > 0 ? "," : "") << pinned[i];
+        if (last > i) {
+            text << "-" << pinned[last];
+        }
+        for (size_t j = i; j <= last; j++) {
+            nodes.insert(node_of(pinned[j]));
+        }
+        i = last;
+    }
+    text << " (node";
+    for (int node : nodes) {
+        text << " " << (node < 0 ? std::string("?") : std::to_string(node));
+    }
+    text << ")";
+    return text.str();
+}
+
+}
@@ -0,0 +1,201 @@
+#include "outofcore.h"
+
+namespace outofcore {
+
+void write_all(int fd, const void *data, size_t bytes, off_t offset) {
+    auto from = static_cast<const char *>(data);
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, from, bytes, offset);
+        if (written <= 0) {
+            throw std::runtime_error("Couldn't write to the scratch file.");
+        }
+        from += written;
+        bytes -= written;
+        offset += written;
+    }
+}
+
+void read_all(int fd, void *data, size_t bytes, off_t offset) {
+    auto to = static_cast<char *>(data);
+    while (bytes > 0) {
+        ssize_t read = pread(fd, to, bytes, offset);
+        if (read <= 0) {
+            throw std::runtime_error("Couldn't read from the scratch file.");
+        }
+        to += read;
+        bytes -= read;
+        offset += read;
+    }
+}
+
+// Returns the rows [first, last) of the matrix as a chunk (with offsets starting from 0).
+std::unique_ptr<matrix::Sparse> rows_of(matrix::Sparse *m, int first, int last) {
+    auto begin = m->rows_number_of_values[first];
+    auto end = m->rows_number_of_values[last];
+    matrix::Buffer<double> values(m->values.begin() + begin, m->values.begin() + end);
+    matrix::Buffer<int> values_column(m->values_column.begin() + begin, m->values_column.begin() + end);
+    matrix::Buffer<matrix::index_t> rows_number_of_values;
+    rows_number_of_values.reserve(last - first + 1);
+    for (int r = first; r <= last; r++) {
+        rows_number_of_values.push_back(m->rows_number_of_values[r] - begin);
+    }
+    auto chunk = std::make_unique<matrix::Sparse>(m->n, std::move(values), std::move(rows_number_of_values),
+                                                  std::move(values_column));
+    chunk->row_base = m->row_base + first;
+    return chunk;
+}
+
+SpilledSparse::SpilledSparse(int n, size_t chunk_values) : n{n}, _chunk_values{std::max<size_t>(chunk_values, 1)} {
+    const char *directory = getenv("TMPDIR");
+    std::string path = std::string(directory != nullptr ? directory : "/tmp") + "/matrixmul-XXXXXX";
+    _fd = mkstemp(&path[0]);
+    if (_fd < 0) {
+        throw std::runtime_error("Couldn't create a scratch file in " + path + ".");
+    }
+    // The file is removed as soon as it is closed.
+    unlink(path.c_str());
+}
+
+SpilledSparse::~SpilledSparse() {
+    close(_fd);
+}
+
+void SpilledSparse::Append(matrix::Sparse *m) {
+    int rows = static_cast<int>(m->rows_number_of_values.size()) - 1;
+    int first = 0;
+    while (first < rows) {
+        int last = first + 1;
+        while (last < rows && static_cast<size_t>(m->rows_number_of_values[last + 1] -
+                                                  m->rows_number_of_values[first]) <= _chunk_values) {
+            last++;
+        }
+        if (m->rows_number_of_values[last] != m->rows_number_of_values[first]) {
+            AppendChunk(rows_of(m, first, last).get());
+        }
+        first = last;
+    }
+}
+
+void SpilledSparse::AppendChunk(matrix::Sparse *chunk) {
+    assert(chunk->rows_number_of_values.front() == 0);
+    Chunk c = {chunk->row_base, static_cast<int>(chunk->rows_number_of_values.size()) - 1, chunk->values.size(),
+               _size};
+    write_all(_fd, chunk->values.data(), c.values * sizeof(double), _size);
+    _size += c.values * sizeof(double);
+    write_all(_fd, chunk->values_column.data(), c.values * sizeof(int), _size);
+    _size += c.values * sizeof(int);
+    write_all(_fd, chunk->rows_number_of_values.data(), (c.rows + 1) * sizeof(matrix::index_t), _size);
+    _size += (c.rows + 1) * sizeof(matrix::index_t);
+    _chunks.push_back(c);
+}
+
+size_t SpilledSparse::Chunks() const {
+    return _chunks.size();
+}
+
+size_t SpilledSparse::ChunkValues() const {
+    return _chunk_values;
+}
+
+size_t SpilledSparse::Values() const {
+    size_t values = 0;
+    for (const auto &c : _chunks) {
+        values += c.values;
+    }
+    return values;
+}
+
+std::unique_ptr<matrix::Sparse> SpilledSparse::ReadChunk(size_t index) const {
+    const Chunk &c = _chunks[index];
+    matrix::Buffer<double> values(c.values);
+    matrix::Buffer<int> values_column(c.values);
+    matrix::Buffer<matrix::index_t> rows_number_of_values(c.rows + 1);
+    off_t offset = c.offset;
+    read_all(_fd, values.data(), c.values * sizeof(double), offset);
+    offset += c.values * sizeof(double);
+    read_all(_fd, values_column.data(), c.values * sizeof(int), offset);
+    offset += c.values * sizeof(int);
+    read_all(_fd, rows_number_of_values.data(), (c.rows + 1) * sizeof(matrix::index_t), offset);
+    auto chunk = std::make_unique<matrix::Sparse>(n, std::move(values), std::move(rows_number_of_values),
+                                                  std::move(values_column));
+    chunk->row_base = c.row_base;
+    return chunk;
+}
+
+void SpilledSparse::ForEachChunk(const std::function<void(matrix::Sparse *)> &f) const {
+    if (_chunks.empty()) {
+        return;
+    }
+    // Double buffering: the next chunk is read while the current one is processed.
+    auto next = std::async(std::launch::async, &SpilledSparse::ReadChunk, this, 0);
+    for (size_t i = 0; i < _chunks.size(); i++) {
+        auto chunk = next.get();
+        if (i + 1 < _chunks.size()) {
+            next = std::async(std::launch::async, &SpilledSparse::ReadChunk, this, i + 1);
+        }
+        f(chunk.get());
+    }
+}
+
+std::unique_ptr<matrix::Sparse> empty_chunk(int n) {
+    return std::make_unique<matrix::Sparse>(n, matrix::Buffer<double>(), matrix::Buffer<matrix::index_t>(),
+                                            matrix::Buffer<int>());
+}
+
+std::unique_ptr<SpilledSparse> Shift(messaging::Communicator *comm, SpilledSparse *m, int sender, int receiver,
+                                     int phase) {
+    auto result = std::make_unique<SpilledSparse>(m->n, m->ChunkValues());
+    // Processes may have different numbers of chunks, the missing ones are sent as empty matrices without rows.
+    auto chunks = static_cast<size_t>(comm->AllReduceMax(m->Chunks()));
+    auto buffer = empty_chunk(m->n);
+    std::future<std::unique_ptr<matrix::Sparse>> next;
+    if (m->Chunks() > 0) {
+        next = std::async(std::launch::async, &SpilledSparse::ReadChunk, m, 0);
+    }
+    for (size_t i = 0; i < chunks; i++) {
+        auto chunk = i < m->Chunks() ? next.get() : empty_chunk(m->n);
+        if (i + 1 < m->Chunks()) {
+            next = std::async(std::launch::async, &SpilledSparse::ReadChunk, m, i + 1);
+        }
+        comm->ShiftSparse(chunk, buffer, sender, receiver, phase);
+        if (!chunk->rows_number_of_values.empty()) {
+            result->AppendChunk(chunk.get());
+        }
+    }
+    return result;
+}
+
+std::unique_ptr<SpilledSparse> AllGather(messaging::Communicator *comm, SpilledSparse *m) {
+    auto result = std::make_unique<SpilledSparse>(m->n, m->ChunkValues());
+    // As in Shift, processes with fewer chunks broadcast empty ones.
+    auto chunks = static_cast<size_t>(comm->AllReduceMax(m->Chunks()));
+    for (int root = 0; root < comm->numProcesses(); root++) {
+        if (root != comm->rank()) {
+            for (size_t i = 0; i < chunks; i++) {
+                auto chunk = comm->BroadcastReceiveSparse(root);
+                if (!chunk->rows_number_of_values.empty()) {
+                    profile::TraceScope trace("merge A");
+                    result->AppendChunk(chunk.get());
+                }
+            }
+            continue;
+        }
+        std::future<std::unique_ptr<matrix::Sparse>> next;
+        if (m->Chunks() > 0) {
+            next = std::async(std::launch::async, &SpilledSparse::ReadChunk, m, 0);
+        }
+        for (size_t i = 0; i < chunks; i++) {
+            auto chunk = i < m->Chunks() ? next.get() : empty_chunk(m->n);
+            if (i + 1 < m->Chunks()) {
+                next = std::async(std::launch::async, &SpilledSparse::ReadChunk, m, i + 1);
+            }
+            comm->BroadcastSendSparse(chunk.get());
+            if (!chunk->rows_number_of_values.empty()) {
+                result->AppendChunk(chunk.get());
+            }
+        }
+    }
+    return result;
+}
+
+}
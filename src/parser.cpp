@@ -3,16 +3,116 @@
 
 namespace parser {
 
+// Parses a list of seeds, e.g. "11", "11,42" or "11-20,42".
+std::vector<int> parse_seeds(const std::string &list) {
+    std::vector<int> seeds;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string item = list.substr(begin, end - begin);
+        char *rest;
+        int first = std::strtol(item.c_str(), &rest, 10);
+        int last = first;
+        if (*rest == '-') {
+            last = std::strtol(rest + 1, &rest, 10);
+        }
+        if (item.empty() || *rest != '\0' || first <= 0 || last < first) {
+            throw std::runtime_error("-s (seed_for_dense_matrix) must be a list of seeds > 0 or ranges of them.");
+        }
+        for (int seed = first; seed <= last; seed++) {
+            seeds.push_back(seed);
+        }
+        begin = end + 1;
+    }
+    return seeds;
+}
+
+std::vector<std::string> parse_statistics(const std::string &list) {
+    const std::vector<std::string> known = {"min", "max", "sum", "mean", "norm"};
+    std::vector<std::string> statistics;
+    std::istringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (std::find(known.begin(), known.end(), item) == known.end()) {
+            throw std::runtime_error("-t (statistics) must be a list of: min, max, sum, mean, norm.");
+        }
+        statistics.push_back(item);
+    }
+    return statistics;
+}
+
+sparsematgen::Spec parse_generator(const std::string &spec) {
+    sparsematgen::Spec generator;
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= spec.size()) {
+        size_t end = spec.find(':', begin);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        items.push_back(spec.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    std::vector<long> numbers;
+    for (size_t i = 1; i < items.size(); i++) {
+        char *rest;
+        numbers.push_back(std::strtol(items[i].c_str(), &rest, 10));
+        if (items[i].empty() || *rest != '\0') {
+            numbers.back() = -1;
+        }
+    }
+    const std::vector<std::string> patterns = {"uniform", "banded", "rmat", "block"};
+    auto pattern = std::find(patterns.begin(), patterns.end(), items[0]);
+    if (pattern == patterns.end() || numbers.size() < 2 || numbers.size() > 3 || numbers[0] <= 0 ||
+        numbers[0] > INT_MAX || numbers[1] <= 0 || numbers[1] > INT_MAX ||
+        (numbers.size() == 3 && (numbers[2] < 0 || numbers[2] > INT_MAX))) {
+        throw std::runtime_error("-G (generated A) must be pattern:n:values_per_row[:seed] with a pattern "
+                                 "one of: uniform, banded, rmat, block, and n, values_per_row > 0.");
+    }
+    generator.pattern = static_cast<sparsematgen::Patterns>(pattern - patterns.begin());
+    generator.n = static_cast<int>(numbers[0]);
+    generator.values_per_row = static_cast<int>(numbers[1]);
+    if (numbers.size() == 3) {
+        generator.seed = static_cast<int>(numbers[2]);
+    }
+    return generator;
+}
+
+matrix::HistogramRange parse_histogram(const std::string &range) {
+    matrix::HistogramRange histogram;
+    char colon1, colon2;
+    std::istringstream items(range);
+    if (!(items >> histogram.low >> colon1 >> histogram.high >> colon2 >> histogram.bins) || colon1 != ':' ||
+        colon2 != ':' || !items.eof() || histogram.low >= histogram.high || histogram.bins <= 0 ||
+        histogram.bins > matrix::MAX_HISTOGRAM_BINS) {
+        throw std::runtime_error("-H (histogram) must be low:high:bins with low < high and 0 < bins <= " +
+                                 std::to_string(matrix::MAX_HISTOGRAM_BINS) + ".");
+    }
+    return histogram;
+}
+
 Arguments::Arguments(int argc, char **argv) {
     int c;
     char *end;
-    while ((c = getopt(argc, argv, "f:s:c:e:g:vim")) != -1) {
+    // Long options are aliases of the short ones.
+    const struct option long_options[] = {{"verify", no_argument, nullptr, 'V'}, {nullptr, 0, nullptr, 0}};
+    while ((c = getopt_long(argc, argv, "f:s:c:e:g:vimbr:a:M:j:RO:S:t:H:o:I:T:G:D:P:L:p:V", long_options,
+                            nullptr)) != -1) {
         switch (c) {
             case 'f':
                 this->sparse_matrix_file = std::string(optarg);
                 break;
+            case 'G':
+                this->generator = parse_generator(std::string(optarg));
+                break;
+            case 'D':
+                this->dump_file = std::string(optarg);
+                break;
             case 's':
-                this->seed = std::strtol(optarg, &end, 10);
+                this->seeds = parse_seeds(std::string(optarg));
                 break;
             case 'c':
                 this->replication_group_size = std::strtol(optarg, &end, 10);
@@ -23,25 +123,123 @@ Arguments::Arguments(int argc, char **argv) {
             case 'g':
                 this->ge_value = std::strtod(optarg, &end);
                 break;
+            case 'p':
+                this->power_iteration = true;
+                this->tolerance = std::strtod(optarg, &end);
+                break;
             case 'v':
                 this->print_the_matrix_c = true;
                 break;
             case 'i':
                 this->algorithm = matrixmul::COLABC;
                 break;
+            case 'a':
+                if (std::string(optarg) == "cola") {
+                    this->algorithm = matrixmul::COLA;
+                } else if (std::string(optarg) == "inner") {
+                    this->algorithm = matrixmul::COLABC;
+                } else if (std::string(optarg) == "colb") {
+                    this->algorithm = matrixmul::COLB;
+                } else if (std::string(optarg) == "summa") {
+                    this->algorithm = matrixmul::SUMMA;
+                } else if (std::string(optarg) == "sparse") {
+                    this->algorithm = matrixmul::SPARSE1D;
+                } else if (std::string(optarg) == "auto") {
+                    this->auto_tune = true;
+                } else {
+                    throw std::runtime_error("-a (algorithm) must be one of: cola, inner, colb, summa, sparse, auto.");
+                }
+                break;
+            case 'M':
+                this->memory_cap = std::strtod(optarg, &end) * (1 << 20);
+                break;
             case 'm':
                 this->mkl = true;
                 break;
+            case 'b':
+                this->balanced = true;
+                break;
+            case 'r':
+                if (std::string(optarg) == "rcm") {
+                    this->reordering = reorder::RCM;
+                } else if (std::string(optarg) == "degree") {
+                    this->reordering = reorder::DEGREE;
+                } else {
+                    throw std::runtime_error("-r (reordering) must be one of: rcm, degree.");
+                }
+                break;
+            case 'S':
+                if (std::string(optarg) == "yes") {
+                    this->symmetry = matrixmul::SYMMETRIC;
+                } else if (std::string(optarg) == "auto") {
+                    this->symmetry = matrixmul::DETECT;
+                } else {
+                    throw std::runtime_error("-S (symmetric A) must be one of: yes, auto.");
+                }
+                break;
+            case 'O':
+                this->memory_budget = std::strtod(optarg, &end) * (1 << 20);
+                break;
+            case 'R':
+                this->report_memory = true;
+                break;
+            case 'V':
+                this->verify = true;
+                break;
+            case 'P':
+                if (std::string(optarg) == "compact") {
+                    this->affinity = numa::COMPACT;
+                } else if (std::string(optarg) == "spread") {
+                    this->affinity = numa::SPREAD;
+                } else {
+                    throw std::runtime_error("-P (pinning) must be one of: compact, spread.");
+                }
+                break;
+            case 'L':
+                if (std::string(optarg) == "thp") {
+                    this->huge_pages = numa::TRANSPARENT;
+                } else if (std::string(optarg) == "hugetlb") {
+                    this->huge_pages = numa::EXPLICIT;
+                } else {
+                    throw std::runtime_error("-L (huge pages) must be one of: thp, hugetlb.");
+                }
+                break;
+            case 'j':
+                this->jobs_file = std::string(optarg);
+                break;
+            case 'o':
+                this->output_file = std::string(optarg);
+                break;
+            case 'I':
+                this->profile_file = std::string(optarg);
+                break;
+            case 'T':
+                this->trace_file = std::string(optarg);
+                break;
+            case 't':
+                this->statistics = parse_statistics(std::string(optarg));
+                break;
+            case 'H':
+                this->histogram = parse_histogram(std::string(optarg));
+                break;
             case '?':
                 throw std::runtime_error(std::string(1, optopt));
             default:
                 throw std::runtime_error("Parsing arguments.");
         }
     }
-    if (this->sparse_matrix_file.empty()) {
-        throw std::runtime_error("-f (sparse_matrix_file) is required.");
+    if (this->sparse_matrix_file.empty() == (this->generator.n == 0)) {
+        throw std::runtime_error("Either -f (sparse_matrix_file) or -G (generated A) is required.");
+    }
+    // The generated A is never gathered, so options needing the whole A aren't supported.
+    if (this->generator.n > 0 && (this->auto_tune || this->balanced || this->reordering != reorder::NONE ||
+                                  this->symmetry != matrixmul::GENERAL)) {
+        throw std::runtime_error("-a auto, -b, -r and -S are not supported with -G (generated A).");
     }
-    if (this->seed <= 0) {
+    if (!this->dump_file.empty() && this->generator.n == 0) {
+        throw std::runtime_error("-D (dump file) requires -G (generated A).");
+    }
+    if (this->seeds.empty() && this->jobs_file.empty()) {
         throw std::runtime_error("-s (seed_for_dense_matrix) is required and must be > 0.");
     }
     if (this->replication_group_size <= 0) {
@@ -50,13 +248,47 @@ Arguments::Arguments(int argc, char **argv) {
     if (this->exponent < 0) {
         throw std::runtime_error("-e (exponent) is required and must be >= 0.");
     }
+    if (this->tolerance < 0) {
+        throw std::runtime_error("-p (tolerance of the power iteration) must be >= 0.");
+    }
+    // Normalized iterates aren't A^e * B.
+    if (this->verify && this->power_iteration) {
+        throw std::runtime_error("--verify is not supported with -p (power iteration).");
+    }
+}
+
+bool parse_job(const std::string &line, Job &job) {
+    std::istringstream items(line);
+    std::string seeds, option;
+    if (!(items >> seeds >> job.exponent) || job.exponent < 0) {
+        return false;
+    }
+    try {
+        job.seeds = parse_seeds(seeds);
+    } catch (std::runtime_error &e) {
+        return false;
+    }
+    job.ge_value = 0;
+    job.print_the_matrix_c = false;
+    while (items >> option) {
+        if (option == "-v") {
+            job.print_the_matrix_c = true;
+        } else if (option == "-g" && items >> job.ge_value) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
 }
 
 std::unique_ptr<matrix::Sparse> parse_sparse_matrix(const std::string &filename) {
-    int rows, columns, total_items, max_row_items;
-    std::vector<double> nonzero_values;
-    std::vector<int> extents_of_rows;
-    std::vector<int> column_indices;
+    int rows, columns;
+    // Read as 64-bit, so that a matrix too large for the index type is reported as such.
+    std::int64_t total_items, max_row_items;
+    matrix::Buffer<double> nonzero_values;
+    matrix::Buffer<matrix::index_t> extents_of_rows;
+    matrix::Buffer<int> column_indices;
 
     std::ifstream f;
     f.open(filename);
@@ -66,7 +298,7 @@ std::unique_ptr<matrix::Sparse> parse_sparse_matrix(const std::string &filename)
 
     try {
         if (!(f >> rows >> columns >> total_items >> max_row_items)) {
-            throw std::runtime_error("Invalid first line - couldn't parse 4 numbers as ints.");
+            throw std::runtime_error("Invalid first line - couldn't parse 4 numbers as integers.");
         }
         if (rows != columns) {
             throw std::runtime_error("Matrix hasn't square dimensions.");
@@ -77,22 +309,26 @@ std::unique_ptr<matrix::Sparse> parse_sparse_matrix(const std::string &filename)
         if (max_row_items < 0) {
             throw std::runtime_error("Matrix number of max row items is negative.");
         }
+        matrix::ToIndex(static_cast<size_t>(total_items));
         // Parse Matrix values.
         double value;
-        for (int i = 0; i < total_items; i++) {
+        nonzero_values.reserve(total_items);
+        for (std::int64_t i = 0; i < total_items; i++) {
             if (!(f >> value)) {
                 throw std::runtime_error("Invalid second line - couldn't parse one of the values as double.");
             }
             nonzero_values.push_back(value);
         }
-        int item;
+        matrix::index_t extent;
         for (int i = 0; i < rows+1; i++) {
-            if (!(f >> item)) {
-                throw std::runtime_error("Invalid third line - couldn't parse one of the values as int.");
+            if (!(f >> extent)) {
+                throw std::runtime_error("Invalid third line - couldn't parse one of the values as an integer.");
             }
-            extents_of_rows.push_back(item);
+            extents_of_rows.push_back(extent);
         }
-        for (int i = 0; i < total_items; i++) {
+        int item;
+        column_indices.reserve(total_items);
+        for (std::int64_t i = 0; i < total_items; i++) {
             if (!(f >> item)) {
                 throw std::runtime_error("Invalid fourth line - couldn't parse one of the values as int.");
             }
@@ -107,4 +343,31 @@ std::unique_ptr<matrix::Sparse> parse_sparse_matrix(const std::string &filename)
         std::move(column_indices));
 }
 
+void write_sparse_matrix(const std::string &filename, const matrix::Sparse &m) {
+    std::ofstream f(filename);
+    if (!f.is_open()) {
+        throw std::runtime_error("Couldn't open the file the matrix is written into.");
+    }
+    matrix::index_t max_row_items = 0;
+    for (size_t r = 0; r + 1 < m.rows_number_of_values.size(); r++) {
+        max_row_items = std::max(max_row_items, m.rows_number_of_values[r + 1] - m.rows_number_of_values[r]);
+    }
+    f << m.n << " " << m.n << " " << m.values.size() << " " << max_row_items << "\n";
+    for (double v : m.values) {
+        f << v << " ";
+    }
+    f << "\n";
+    for (auto offset : m.rows_number_of_values) {
+        f << offset << " ";
+    }
+    f << "\n";
+    for (int c : m.values_column) {
+        f << c << " ";
+    }
+    f << "\n";
+    if (!f) {
+        throw std::runtime_error("Couldn't write the matrix into " + filename + ".");
+    }
+}
+
 }
@@ -0,0 +1,117 @@
+#include "profile.h"
+#include "communicator.h"
+
+namespace profile {
+
+const char *const TIMER_NAMES[TIMERS] = {"distribution", "replication", "computation", "multiply", "shift", "combine",
+                                   "final"};
+const char *TRAFFIC_NAMES[TRAFFIC_KINDS] = {"point_to_point", "broadcast", "reduction", "all_to_all"};
+
+bool tracing = false;
+
+TraceBuffer &Trace() {
+    static TraceBuffer trace;
+    return trace;
+}
+
+Measurements &Local() {
+    static Measurements measurements;
+    return measurements;
+}
+
+// Writes {"min": .., "max": .., "mean": ..} of the measurement 'i'. Counts are written with all of their digits
+// (so that they can be compared exactly), times with the default precision.
+void write_summary(std::ostream &os, const std::vector<double> &min, const std::vector<double> &max,
+                   const std::vector<double> &sum, size_t i, int processes, bool count, double scale = 1) {
+    auto precision = os.precision(count ? std::numeric_limits<double>::max_digits10 : os.precision());
+    os << "{\"min\": " << min[i] * scale << ", \"max\": " << max[i] * scale << ", \"mean\": "
+       << sum[i] * scale / processes << "}";
+    os.precision(precision);
+}
+
+void Report(messaging::Communicator *comm, std::ostream &os) {
+    // All of the measurements are reduced at once: seconds and calls of the timers, then messages and bytes.
+    auto &local = Local();
+    std::vector<double> values(2 * TIMERS + 2 * TRAFFIC_KINDS);
+    for (int t = 0; t < TIMERS; t++) {
+        values[t] = local.seconds[t];
+        values[TIMERS + t] = local.calls[t];
+    }
+    for (int k = 0; k < TRAFFIC_KINDS; k++) {
+        values[2 * TIMERS + k] = local.messages[k];
+        values[2 * TIMERS + TRAFFIC_KINDS + k] = local.bytes[k];
+    }
+    auto min = comm->ReduceDoubles(values, MPI_MIN);
+    auto max = comm->ReduceDoubles(values, MPI_MAX);
+    auto sum = comm->ReduceDoubles(values, MPI_SUM);
+    if (!comm->isCoordinator()) {
+        return;
+    }
+
+    int p = comm->numProcesses();
+    os << "{\n  \"processes\": " << p << ",\n  \"timers\": {";
+    for (int t = 0; t < TIMERS; t++) {
+        os << (t > 0 ? "," : "") << "\n    \"" << TIMER_NAMES[t] << "\": {\"seconds\": ";
+        write_summary(os, min, max, sum, t, p, false);
+        os << ", \"calls\": ";
+        write_summary(os, min, max, sum, TIMERS + t, p, true);
+        os << "}";
+    }
+    os << "\n  },\n  \"traffic\": {";
+    size_t messages = 2 * TIMERS, bytes = 2 * TIMERS + TRAFFIC_KINDS;
+    for (int k = 0; k < TRAFFIC_KINDS; k++) {
+        os << (k > 0 ? "," : "") << "\n    \"" << TRAFFIC_NAMES[k] << "\": {\"messages\": ";
+        write_summary(os, min, max, sum, messages + k, p, true);
+        os << ", \"bytes\": ";
+        write_summary(os, min, max, sum, bytes + k, p, true);
+        os << ", \"words\": ";
+        write_summary(os, min, max, sum, bytes + k, p, true, 1.0 / 8);
+        os << "}";
+    }
+    os << "\n  }\n}" << std::endl;
+}
+
+void StartTrace(messaging::Communicator *comm, size_t capacity) {
+    auto &trace = Trace();
+    trace.events.resize(std::max<size_t>(capacity, 1));
+    comm->Barrier();
+    trace.start = MPI_Wtime();
+    tracing = true;
+}
+
+void WriteTrace(messaging::Communicator *comm, const std::string &path) {
+    tracing = false;
+    auto &trace = Trace();
+    size_t recorded = trace.recorded.load();
+    size_t capacity = trace.events.size();
+    // Events of the process as "complete" events (times in microseconds, with nanoseconds), oldest first.
+    std::ostringstream events;
+    events << std::fixed << std::setprecision(3);
+    for (size_t i = recorded > capacity ? recorded - capacity : 0; i < recorded; i++) {
+        const auto &e = trace.events[i % capacity];
+        events << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": " << comm->rank()
+               << ", \"tid\": 0, \"ts\": " << (e.begin - trace.start) * 1e6 << ", \"dur\": "
+               << (e.end - e.begin) * 1e6 << ", \"args\": {\"step\": " << e.step << ", \"round\": " << e.round
+               << "}}";
+    }
+    if (recorded > capacity) {
+        std::cerr << "Trace of process " << comm->rank() << ": " << recorded - capacity
+                  << " oldest events were overwritten." << std::endl;
+    }
+    auto text = comm->GatherChars(events.str());
+    if (!comm->isCoordinator()) {
+        return;
+    }
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Couldn't open the trace file.");
+    }
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    for (int p = 0; p < comm->numProcesses(); p++) {
+        file << (p > 0 ? ",\n" : "") << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << p
+             << ", \"args\": {\"name\": \"rank " << p << "\"}}";
+    }
+    file << text << "\n]}" << std::endl;
+}
+
+}
@@ -0,0 +1,147 @@
+#include "reorder.h"
+
+namespace reorder {
+
+// Returns neighbours of every vertex in the (symmetrized) graph of the matrix.
+std::vector<std::vector<int>> adjacency(matrix::Sparse *m) {
+    std::vector<std::vector<int>> neighbours(m->n);
+    int rows = static_cast<int>(m->rows_number_of_values.size()) - 1;
+    for (int r = 0; r < rows; r++) {
+        for (matrix::index_t i = m->rows_number_of_values[r]; i < m->rows_number_of_values[r + 1]; i++) {
+            int c = m->values_column[i];
+            if (c == r) {
+                continue;
+            }
+            neighbours[r].push_back(c);
+            neighbours[c].push_back(r);
+        }
+    }
+    for (auto &v : neighbours) {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+    return neighbours;
+}
+
+std::vector<int> by_degree(const std::vector<std::vector<int>> &neighbours) {
+    std::vector<int> order(neighbours.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&neighbours](int a, int b) {
+        return neighbours[a].size() < neighbours[b].size();
+    });
+    return order;
+}
+
+std::vector<int> permutation_rcm(const std::vector<std::vector<int>> &neighbours) {
+    int n = static_cast<int>(neighbours.size());
+    std::vector<int> order;
+    std::vector<bool> visited(n, false);
+    auto degree_cmp = [&neighbours](int a, int b) {
+        return neighbours[a].size() < neighbours[b].size();
+    };
+    // Every connected component is traversed (BFS) starting from its vertex of the lowest degree.
+    for (int start : by_degree(neighbours)) {
+        if (visited[start]) {
+            continue;
+        }
+        std::queue<int> queue;
+        queue.push(start);
+        visited[start] = true;
+        while (!queue.empty()) {
+            int v = queue.front();
+            queue.pop();
+            order.push_back(v);
+            std::vector<int> next;
+            for (int u : neighbours[v]) {
+                if (!visited[u]) {
+                    visited[u] = true;
+                    next.push_back(u);
+                }
+            }
+            std::stable_sort(next.begin(), next.end(), degree_cmp);
+            for (int u : next) {
+                queue.push(u);
+            }
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+std::vector<int> Permutation(matrix::Sparse *m, Methods method) {
+    auto neighbours = adjacency(m);
+    switch (method) {
+        case RCM:
+            return permutation_rcm(neighbours);
+        case DEGREE:
+            return by_degree(neighbours);
+        case NONE:
+            break;
+    }
+    std::vector<int> identity(m->n);
+    std::iota(identity.begin(), identity.end(), 0);
+    return identity;
+}
+
+std::vector<int> PermutationInverse(const std::vector<int> &permutation) {
+    std::vector<int> inverse(permutation.size());
+    for (size_t i = 0; i < permutation.size(); i++) {
+        inverse[permutation[i]] = static_cast<int>(i);
+    }
+    return inverse;
+}
+
+std::unique_ptr<matrix::Sparse> Permute(matrix::Sparse *m, const std::vector<int> &permutation) {
+    auto inverse = PermutationInverse(permutation);
+    int rows = static_cast<int>(m->rows_number_of_values.size()) - 1;
+    matrix::Buffer<double> values;
+    matrix::Buffer<matrix::index_t> rows_number_of_values;
+    matrix::Buffer<int> values_column;
+    values.reserve(m->values.size());
+    values_column.reserve(m->values_column.size());
+    rows_number_of_values.push_back(0);
+
+    std::vector<std::pair<int, double>> row;
+    for (int r = 0; r < m->n; r++) {
+        int from = permutation[r];
+        row.clear();
+        if (from < rows) {
+            for (matrix::index_t i = m->rows_number_of_values[from]; i < m->rows_number_of_values[from + 1]; i++) {
+                row.emplace_back(inverse[m->values_column[i]], m->values[i]);
+            }
+        }
+        std::sort(row.begin(), row.end());
+        for (const auto &item : row) {
+            values_column.push_back(item.first);
+            values.push_back(item.second);
+        }
+        rows_number_of_values.push_back(static_cast<matrix::index_t>(values.size()));
+    }
+    return std::make_unique<matrix::Sparse>(m->n, std::move(values), std::move(rows_number_of_values),
+                                            std::move(values_column));
+}
+
+long Bandwidth(matrix::Sparse *m) {
+    long bandwidth = 0;
+    auto it = matrix::SparseIt(m);
+    while (it.Next()) {
+        auto v = it.Value();
+        bandwidth = std::max(bandwidth, static_cast<long>(std::abs(std::get<0>(v) - std::get<1>(v))));
+    }
+    return bandwidth;
+}
+
+long Profile(matrix::Sparse *m) {
+    long profile = 0;
+    int rows = static_cast<int>(m->rows_number_of_values.size()) - 1;
+    for (int r = 0; r < rows; r++) {
+        int first = r;
+        for (matrix::index_t i = m->rows_number_of_values[r]; i < m->rows_number_of_values[r + 1]; i++) {
+            first = std::min(first, m->values_column[i]);
+        }
+        profile += r - first;
+    }
+    return profile;
+}
+
+}
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_set>
+#include "sparsematgen.h"
+
+namespace sparsematgen {
+
+// Probabilities of the quadrants of R-MAT (a, b, c, d), the ones commonly used for graph benchmarks.
+const double RMAT_A = 0.57;
+const double RMAT_B = 0.19;
+const double RMAT_C = 0.19;
+const double RMAT_D = 0.05;
+
+// Diagonal blocks of BLOCK_DIAGONAL have this many times more columns than the values of a row.
+const int BLOCK_WIDTH_FACTOR = 4;
+
+// Salts separating the random numbers used for columns, numbers of values and values.
+const uint64_t SALT_COLUMNS = 1;
+const uint64_t SALT_DEGREE = 2;
+const uint64_t SALT_VALUES = 3;
+
+// Finalizer of SplitMix64: a bijection of 64-bit words mixing all of the bits.
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t hash(const Spec &spec, uint64_t salt, uint64_t a, uint64_t b) {
+    return mix(mix(mix(static_cast<uint32_t>(spec.seed) * 4 + salt) ^ a) ^ b);
+}
+
+// Uniform number in [0, 1).
+double uniform(uint64_t h) {
+    return static_cast<double>(h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Draws columns until 'target' of them are distinct (or too many of them are repeated), 'draw(i)' returns
+// the i-th column of the row.
+template <typename Draw>
+std::vector<int> distinct_columns(int target, Draw draw) {
+    // Short rows are checked for repeated columns directly, long ones with a hash set.
+    const int short_row = 64;
+    std::vector<int> columns;
+    columns.reserve(target);
+    std::unordered_set<int> drawn;
+    const long max_draws = 4L * target + 16;
+    for (long i = 0; static_cast<int>(columns.size()) < target && i < max_draws; i++) {
+        int column = draw(i);
+        bool repeated = target <= short_row ? std::find(columns.begin(), columns.end(), column) != columns.end()
+                                            : !drawn.insert(column).second;
+        if (!repeated) {
+            columns.push_back(column);
+        }
+    }
+    std::sort(columns.begin(), columns.end());
+    return columns;
+}
+
+// Number of levels of R-MAT: bits of the row and column indices.
+int rmat_levels(int n) {
+    int levels = 0;
+    while ((1L << levels) < n) {
+        levels++;
+    }
+    return levels;
+}
+
+// Probability of the row (the product of probabilities of the halves chosen by its bits).
+double rmat_share(int row, int levels) {
+    double share = 1;
+    for (int level = levels - 1; level >= 0; level--) {
+        share *= ((row >> level) & 1) ? RMAT_C + RMAT_D : RMAT_A + RMAT_B;
+    }
+    return share;
+}
+
+// Probability of the rows [0, n) (rows >= n exist only if n isn't a power of 2).
+double rmat_share_below(int n, int levels) {
+    if (n == (1L << levels)) {
+        return 1;
+    }
+    double below = 0;
+    double prefix = 1;
+    for (int level = levels - 1; level >= 0; level--) {
+        if ((n >> level) & 1) {
+            below += prefix * (RMAT_A + RMAT_B);
+            prefix *= RMAT_C + RMAT_D;
+        } else {
+            prefix *= RMAT_A + RMAT_B;
+        }
+    }
+    return below;
+}
+
+// Number of values of the row in R-MAT: its share of all of the n * values_per_row values, rounded at random.
+int rmat_degree(const Spec &spec, int row, int levels) {
+    double expected = rmat_share(row, levels) / rmat_share_below(spec.n, levels) * spec.values_per_row *
+                      static_cast<double>(spec.n);
+    double whole = std::floor(expected);
+    if (uniform(hash(spec, SALT_DEGREE, row, 0)) < expected - whole) {
+        whole++;
+    }
+    return static_cast<int>(std::min<double>(whole, spec.n));
+}
+
+// Column of the i-th value of the row in R-MAT: the quadrants are chosen level by level, given the bits of the row.
+// Each level uses 16 bits of the hash (a new hash is mixed every 4 levels).
+int rmat_column(const Spec &spec, int row, int levels, long i) {
+    const double scale = 1 << 16;
+    const double right_of_top = RMAT_B / (RMAT_A + RMAT_B) * scale;
+    const double right_of_bottom = RMAT_D / (RMAT_C + RMAT_D) * scale;
+    uint64_t h = hash(spec, SALT_COLUMNS, row, i);
+    int column = 0;
+    for (int level = levels - 1, used = 0; level >= 0; level--, used++) {
+        if (used == 4) {
+            h = mix(h);
+            used = 0;
+        }
+        double bits = static_cast<double>((h >> (16 * used)) & 0xffff);
+        column = 2 * column + (bits < (((row >> level) & 1) ? right_of_bottom : right_of_top));
+    }
+    return column;
+}
+
+std::vector<int> RowColumns(const Spec &spec, int row) {
+    int target = std::min(spec.values_per_row, spec.n);
+    switch (spec.pattern) {
+        case UNIFORM:
+            return distinct_columns(target, [&](long i) {
+                return static_cast<int>(hash(spec, SALT_COLUMNS, row, i) % spec.n);
+            });
+        case BANDED: {
+            int first = std::max(0, std::min(row - target / 2, spec.n - target));
+            std::vector<int> columns(target);
+            for (int i = 0; i < target; i++) {
+                columns[i] = first + i;
+            }
+            return columns;
+        }
+        case POWER_LAW: {
+            int levels = rmat_levels(spec.n);
+            // Columns out of the matrix (if n isn't a power of 2) are drawn again.
+            return distinct_columns(rmat_degree(spec, row, levels), [&](long i) {
+                int column;
+                do {
+                    column = rmat_column(spec, row, levels, i);
+                    i += 1L << 40;
+                } while (column >= spec.n);
+                return column;
+            });
+        }
+        case BLOCK_DIAGONAL: {
+            int width = std::max(1, BLOCK_WIDTH_FACTOR * spec.values_per_row);
+            int first = row / width * width;
+            int last = std::min(spec.n, first + width);
+            return distinct_columns(std::min(target, last - first), [&](long i) {
+                return first + static_cast<int>(hash(spec, SALT_COLUMNS, row, i) % (last - first));
+            });
+        }
+    }
+    return {};
+}
+
+double Value(const Spec &spec, int row, int column) {
+    const uint64_t resolution = 1000;
+    return static_cast<double>(hash(spec, SALT_VALUES, row, column) % resolution + 1) / resolution;
+}
+
+std::unique_ptr<matrix::Sparse> GenerateRows(const Spec &spec, int first, int last) {
+    matrix::Buffer<double> values;
+    matrix::Buffer<int> values_column;
+    matrix::Buffer<matrix::index_t> rows_number_of_values(first + 1, 0);
+    rows_number_of_values.reserve(last + 1);
+    for (int row = first; row < last; row++) {
+        for (int column : RowColumns(spec, row)) {
+            values.push_back(Value(spec, row, column));
+            values_column.push_back(column);
+        }
+        rows_number_of_values.push_back(matrix::ToIndex(values.size()));
+    }
+    return std::make_unique<matrix::Sparse>(spec.n, std::move(values), std::move(rows_number_of_values),
+                                            std::move(values_column));
+}
+
+}
@@ -0,0 +1,186 @@
+#include "tuner.h"
+
+namespace tuner {
+
+// Sizes of messages used to measure latency and bandwidth.
+const int PING_SMALL_BYTES = 8;
+const int PING_LARGE_BYTES = 1 << 20;
+// Approximate number of values of A used to measure the local kernel.
+const long SAMPLE_VALUES = 1 << 16;
+const int SAMPLE_COLUMNS = 32;
+
+// Bytes needed to store (and send) a single value of a sparse / dense matrix.
+const double SPARSE_VALUE_BYTES = sizeof(double) + sizeof(int);
+const double DENSE_VALUE_BYTES = sizeof(double);
+
+const char *algorithm_name(matrixmul::Algorithms algorithm) {
+    switch (algorithm) {
+        case matrixmul::COLA:
+            return "cola";
+        case matrixmul::COLABC:
+            return "inner";
+        case matrixmul::COLB:
+            return "colb";
+        case matrixmul::SUMMA:
+            return "summa";
+        case matrixmul::SPARSE1D:
+            return "sparse";
+    }
+    return "unknown";
+}
+
+// Returns the first rows of the matrix holding (about) a given number of values.
+std::unique_ptr<matrix::Sparse> sample(matrix::Sparse *m, long values) {
+    int rows = 0;
+    int last_row = static_cast<int>(m->rows_number_of_values.size()) - 1;
+    while (rows < last_row && m->rows_number_of_values[rows] < values) {
+        rows++;
+    }
+    matrix::index_t items = m->rows_number_of_values[rows];
+    matrix::Buffer<double> sample_values(m->values.begin(), m->values.begin() + items);
+    matrix::Buffer<matrix::index_t> sample_rows(m->rows_number_of_values.begin(),
+                                                m->rows_number_of_values.begin() + rows + 1);
+    matrix::Buffer<int> sample_columns(m->values_column.begin(), m->values_column.begin() + items);
+    return std::make_unique<matrix::Sparse>(m->n, std::move(sample_values), std::move(sample_rows),
+                                            std::move(sample_columns));
+}
+
+// Measures the link between the process and its peer in the group (if it has one) and returns the slowest link
+// of all of the processes. All of the pairs ping-pong at the same time, like in the transfers they model.
+Link measure(messaging::Communicator *com, messaging::Communicator *group, int peer) {
+    Link link = {0, 0};
+    if (peer >= 0 && peer < group->numProcesses()) {
+        link.latency = group->PingPong(peer, PING_SMALL_BYTES, 100);
+        double large = group->PingPong(peer, PING_LARGE_BYTES, 10);
+        link.byte_time = std::max(0.0, (large - link.latency) / PING_LARGE_BYTES);
+    }
+    link.latency = com->AllReduceMax(link.latency);
+    link.byte_time = com->AllReduceMax(link.byte_time);
+    return link;
+}
+
+Machine Calibrate(messaging::Communicator *com, matrix::Sparse *full_matrix) {
+    Machine machine;
+    machine.flop_time = 0;
+    int p = com->numProcesses();
+    int rank = com->rank();
+    for (int c = 1; c <= p; c++) {
+        if (p % c != 0) {
+            continue;
+        }
+        // A is shifted between ranks c apart: neighbouring blocks of c ranks are paired (0-c, 2c-3c, ...).
+        int peer = -1;
+        if (p / c > 1) {
+            peer = (rank / c) % 2 == 0 ? rank + c : rank - c;
+        }
+        machine.shift[c] = measure(com, com, peer < p ? peer : -1);
+        if (c == 1) {
+            continue;
+        }
+        // Replication groups are split off the same way as by the algorithms, members are paired within them.
+        auto consecutive = com->Split(rank / c);
+        machine.consecutive[c] = measure(com, &consecutive, consecutive.rank() ^ 1);
+        if (p % (c * c) == 0) {
+            auto inner = com->Split(matrixmul::group_divider(rank, c, p).second);
+            machine.inner[c] = measure(com, &inner, inner.rank() ^ 1);
+        }
+    }
+    if (com->isCoordinator()) {
+        auto m = sample(full_matrix, SAMPLE_VALUES);
+        if (!m->values.empty()) {
+            double time = matrix::MultiplyTime(m.get(), SAMPLE_COLUMNS);
+            machine.flop_time = time / (2.0 * m->values.size() * SAMPLE_COLUMNS);
+        }
+    }
+    machine.flop_time = com->AllReduceMax(machine.flop_time);
+    return machine;
+}
+
+std::vector<Plan> Plans(const Machine &machine, int processes, int n, long values, int exponent, int batch) {
+    double p = processes;
+    double a_block = SPARSE_VALUE_BYTES * values / p;             // Initial block of A (shared by the batch).
+    double dense_block = DENSE_VALUE_BYTES * batch * n * static_cast<double>(n) / p; // Initial block of B (and C).
+    double compute = machine.flop_time * 2.0 * values * n * batch / p; // Single multiplication.
+    auto message = [](const Link &link, double bytes) {
+        return link.latency + link.byte_time * bytes;
+    };
+
+    std::vector<Plan> plans;
+    for (int c = 1; c <= processes; c++) {
+        if (processes % c != 0) {
+            continue;
+        }
+        // ColA: A is replicated, each multiplication shifts (p / c) blocks of c times larger A.
+        const Link none = {0, 0};
+        const Link &shift = machine.shift.at(c);
+        const Link &consecutive = c > 1 ? machine.consecutive.at(c) : none;
+        double replication = (c - 1) * message(consecutive, a_block);
+        double multiplication = (p / c) * message(shift, c * a_block) + compute;
+        plans.push_back({matrixmul::COLA, c, replication + exponent * multiplication,
+                         2 * c * a_block + 2 * dense_block});
+
+        if (processes % (c * c) != 0) {
+            continue;
+        }
+        // InnerABC: all matrices are replicated, each multiplication shifts (p / c^2) blocks of A,
+        // partial results of the replication group are summed up after every multiplication.
+        const Link &inner = c > 1 ? machine.inner.at(c) : none;
+        replication = (c - 1) * (message(inner, a_block) + message(consecutive, dense_block));
+        multiplication = (p / (c * c)) * message(shift, c * a_block) + compute;
+        double combine = (c - 1) * message(consecutive, c * dense_block);
+        plans.push_back({matrixmul::COLABC, c, replication + exponent * (multiplication + combine),
+                         2 * c * a_block + 2 * c * dense_block});
+    }
+    return plans;
+}
+
+Plan Tune(messaging::Communicator *com, matrix::Sparse *full_matrix, int exponent, double memory_cap,
+          int batch) {
+    auto machine = Calibrate(com, full_matrix);
+    std::vector<int> chosen(2);
+    if (com->isCoordinator()) {
+        auto plans = Plans(machine, com->numProcesses(), full_matrix->n, full_matrix->values.size(), exponent,
+                           batch);
+        auto describe = [](const Link &link) {
+            std::ostringstream text;
+            text << link.latency << "s, " << (link.byte_time > 0 ? 1e-9 / link.byte_time : 0) << " GB/s";
+            return text.str();
+        };
+        std::cerr << "Auto-tuning: kernel " << (machine.flop_time > 0 ? 1e-9 / machine.flop_time : 0)
+                  << " GFLOP/s" << std::endl;
+        for (const auto &shift : machine.shift) {
+            int c = shift.first;
+            std::cerr << "  links for c=" << c << ": shift " << describe(shift.second);
+            if (machine.consecutive.count(c) > 0) {
+                std::cerr << ", consecutive group " << describe(machine.consecutive.at(c));
+            }
+            if (machine.inner.count(c) > 0) {
+                std::cerr << ", inner group of A " << describe(machine.inner.at(c));
+            }
+            std::cerr << std::endl;
+        }
+        const Plan *best = nullptr;
+        for (const auto &plan : plans) {
+            bool fits = memory_cap <= 0 || plan.memory <= memory_cap;
+            std::cerr << "  " << algorithm_name(plan.algorithm) << " c=" << plan.c << ": predicted " << plan.cost
+                      << "s, memory " << plan.memory / (1 << 20) << " MB" << (fits ? "" : " (over the cap)")
+                      << std::endl;
+            if (fits && (best == nullptr || plan.cost < best->cost)) {
+                best = &plan;
+            }
+        }
+        if (best == nullptr) {
+            std::cerr << "No plan fits in the memory cap, falling back to the smallest one." << std::endl;
+            best = &plans.front();
+        }
+        std::cerr << "Chosen: " << algorithm_name(best->algorithm) << " c=" << best->c << " (predicted "
+                  << best->cost << "s)" << std::endl;
+        chosen = {best->algorithm, best->c};
+        com->BroadcastSendInts(chosen);
+        return *best;
+    }
+    chosen = com->BroadcastReceiveInts(com->rankCoordinator());
+    return {static_cast<matrixmul::Algorithms>(chosen[0]), chosen[1], 0, 0};
+}
+
+}
@@ -0,0 +1,144 @@
+// Test of transfers of matrices between processes (run with a few of them, e.g. `mpiexec -n 3`).
+// It is compiled with a tiny MATRIXMUL_MAX_MESSAGE_ITEMS, so that blocks of a few thousand values take the same
+// paths (split into a few messages or rounds) as blocks of more than 2^31 values, and with both index types.
+// Failed checks are printed on stderr, the exit code is non-zero if any check of any process failed.
+#include <iostream>
+#include <random>
+#include <string>
+#include "communicator.h"
+#include "matrix.h"
+
+namespace {
+
+bool failed = false;
+
+void check(bool condition, const std::string &what, messaging::Communicator &comm) {
+    if (!condition) {
+        std::cerr << "Process " << comm.rank() << ": " << what << " failed." << std::endl;
+        failed = true;
+    }
+}
+
+bool same(const matrix::Dense &a, const matrix::Dense &b, double scale = 1) {
+    if (a.rows != b.rows || a.row_base != b.row_base || a.column_base != b.column_base || a.columns != b.columns ||
+        a.columns_total != b.columns_total || a.n_original != b.n_original || a.batch != b.batch ||
+        a.panels != b.panels || a.values.size() != b.values.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.values.size(); i++) {
+        if (std::abs(a.values[i] - scale * b.values[i]) > 1e-9) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool same(const matrix::Sparse &a, const matrix::Sparse &b) {
+    return a.n == b.n && a.row_base == b.row_base && a.values == b.values && a.values_column == b.values_column &&
+           a.rows_number_of_values == b.rows_number_of_values;
+}
+
+// The same random matrix on every process (different for every 'seed').
+std::unique_ptr<matrix::Sparse> random_sparse(int n, size_t values, unsigned seed) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> index(0, n - 1);
+    std::vector<int> coordinates;
+    matrix::Buffer<double> v;
+    for (size_t i = 0; i < values; i++) {
+        coordinates.push_back(index(random));
+        coordinates.push_back(index(random));
+        v.push_back(static_cast<double>(random() % 1000) / 1000);
+    }
+    auto m = std::make_unique<matrix::Sparse>(n, coordinates, v);
+    m->row_base = static_cast<int>(seed);
+    return m;
+}
+
+// Block of the given rows and columns made of a panel for every process, like a merged block of C.
+std::unique_ptr<matrix::Dense> random_panels(int n, int processes, const std::vector<int> &seeds) {
+    auto partition = matrix::PartitionUniform(n, processes);
+    matrix::Denses ds;
+    for (int i = 0; i < processes; i++) {
+        ds.push_back(std::make_unique<matrix::Dense>(n, n, std::make_pair(partition[i], partition[i + 1]), seeds));
+    }
+    return matrix::Merge(std::move(ds));
+}
+
+}
+
+int main(int argc, char **argv) {
+    messaging::Communicator comm(argc, argv);
+    const int n = 120;
+    const int root = comm.numProcesses() - 1;
+    static_assert(MATRIXMUL_MAX_MESSAGE_ITEMS < 120 * 40, "Blocks of the test must be split into a few messages.");
+
+    // Dense blocks: a batch of two matrices, n x 40 values each.
+    matrix::Dense dense(n, n, std::make_pair(10, 50), std::vector<int>{11, 12});
+    dense.row_base = 3;
+    if (comm.rank() == 0) {
+        for (int i = 1; i < comm.numProcesses(); i++) {
+            comm.SendDense(&dense, i, 0);
+        }
+    } else {
+        check(same(*comm.ReceiveDense(0, 0), dense), "SendDense / ReceiveDense", comm);
+    }
+    if (comm.rank() == root) {
+        comm.BroadcastSendDense(&dense);
+    } else {
+        check(same(*comm.BroadcastReceiveDense(root), dense), "BroadcastSendDense / BroadcastReceiveDense", comm);
+    }
+    auto sum = std::make_unique<matrix::Dense>(dense);
+    comm.AllReduceSumDense(sum.get());
+    check(same(*sum, dense, comm.numProcesses()), "AllReduceSumDense", comm);
+
+    // A merged block is sent with its panels and reduce-scattered panel by panel.
+    auto panels = random_panels(n, comm.numProcesses(), {21, 22});
+    if (comm.rank() == 0) {
+        for (int i = 1; i < comm.numProcesses(); i++) {
+            comm.SendDense(panels.get(), i, 1);
+        }
+    } else {
+        check(same(*comm.ReceiveDense(0, 1), *panels), "SendDense / ReceiveDense of panels", comm);
+    }
+    auto part = comm.ReduceScatterSumDense(panels.get());
+    check(same(*part, *panels->Panel(comm.rank()), comm.numProcesses()), "ReduceScatterSumDense", comm);
+
+    // Sparse blocks of a few thousand values.
+    auto sparse = random_sparse(n, 5000, 7);
+    if (comm.rank() == 0) {
+        for (int i = 1; i < comm.numProcesses(); i++) {
+            comm.SendSparse(sparse.get(), i, 2);
+        }
+    } else {
+        check(same(*comm.ReceiveSparse(0, 2), *sparse), "SendSparse / ReceiveSparse", comm);
+    }
+    if (comm.rank() == root) {
+        comm.BroadcastSendSparse(sparse.get());
+    } else {
+        check(same(*comm.BroadcastReceiveSparse(root), *sparse), "BroadcastSendSparse / BroadcastReceiveSparse",
+              comm);
+    }
+    // Every process shifts its own matrix to the next one along the ring.
+    int p = comm.numProcesses();
+    auto own = random_sparse(n, 3000 + 500 * comm.rank(), 100 + comm.rank());
+    auto buffer = random_sparse(n, 0, 0);
+    int sender = (comm.rank() + p - 1) % p;
+    comm.ShiftSparse(own, buffer, sender, (comm.rank() + 1) % p, 3);
+    check(same(*own, *random_sparse(n, 3000 + 500 * sender, 100 + sender)), "ShiftSparse", comm);
+
+    // Sizes of sparse matrices which don't fit in the index type are rejected.
+    bool rejected = false;
+    try {
+        matrix::ToIndex(static_cast<size_t>(std::numeric_limits<std::int32_t>::max()) + 1);
+    } catch (std::runtime_error &) {
+        rejected = true;
+    }
+    check(rejected == (sizeof(matrix::index_t) == 4), "ToIndex", comm);
+
+    bool any_failed = comm.AllReduceMax(failed ? 1 : 0) > 0;
+    if (comm.isCoordinator() && !any_failed) {
+        std::cerr << "All checks passed (index of " << 8 * sizeof(matrix::index_t) << " bits, "
+                  << MATRIXMUL_MAX_MESSAGE_ITEMS << " items per message)." << std::endl;
+    }
+    return any_failed ? 1 : 0;
+}